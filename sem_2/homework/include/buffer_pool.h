@@ -0,0 +1,39 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+    fixed set of aligned buffers carved out of one allocation.
+    A buffer returns to the free list when its last reference is released,
+    so several chunks can be in flight and be freed in any order.
+*/
+typedef struct Buffer {
+        char*               data;
+        size_t              size;       // capacity
+        size_t              len;        // bytes of payload
+        _Atomic uint32_t    refs;
+        uint32_t            index;      // position in the pool
+} Buffer;
+
+typedef struct BufferPool {
+        Buffer*             bufs;
+        _Atomic uint32_t*   next;       // free list links
+        _Atomic uint64_t    free_head;  // ABA tag in the upper half, buffer index in the lower
+        _Atomic size_t      available;
+        char*               mem;
+        size_t              count;
+        size_t              buf_size;
+} BufferPool;
+
+BufferPool* CreateBufferPool    (size_t count, size_t buf_size, size_t align);
+void        DestroyBufferPool   (BufferPool *pool);
+
+Buffer*     BufferAcquire       (BufferPool *pool);
+void        BufferRetain        (Buffer *buf);
+void        BufferRelease       (BufferPool *pool, Buffer *buf);
+size_t      BufferPoolAvailable (const BufferPool *pool);
+
+#endif // BUFFER_POOL_H
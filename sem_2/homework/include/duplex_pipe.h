@@ -6,13 +6,26 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdint.h>
+
+#include "histogram.h"
 
 typedef struct DuplexPipe   DuplexPipe;
 typedef struct op_table     Ops;
 
+/*
+    framed message: header and payload go out in one writev(),
+    payload length is limited by the pipe buffer size
+*/
+typedef struct MsgHeader {
+    uint32_t    len;            // payload length in bytes
+} MsgHeader;
+
 typedef struct op_table  {
     ssize_t     (*rcv)(DuplexPipe *self);
     ssize_t     (*snd)(DuplexPipe *self);
+    ssize_t     (*rcv_msg)(DuplexPipe *self);
+    ssize_t     (*snd_msg)(DuplexPipe *self);
     void        (*close_child)(DuplexPipe *self);
     void        (*close_parent)(DuplexPipe *self);
     void        (*close_all)(DuplexPipe *self);
@@ -23,12 +36,19 @@ typedef struct DuplexPipe {
         size_t  data_size;
         int     fd_direct[2];   // array of r/w descriptors for "pipe()" call (for parent-->child direction)
         int     fd_back[2];     // array of r/w descriptors for "pipe()" call (for child-->parent direction)
+        int     fd_rd;          // read end of the current side (set by close_child/close_parent)
+        int     fd_wr;          // write end of the current side (set by close_child/close_parent)
         size_t  len;            // data length in intermediate buffer
+        char*   spill;          // bytes of the next messages read ahead by rcv_msg
+        size_t  spill_len;
+        Histogram* latency;     // optional, round trip latency recorded by Run()
+        int     parent_cpu;     // logical CPUs Run() pins the processes to, -1 - not pinned
+        int     child_cpu;
         Ops     actions;
 } DuplexPipe;
 
 DuplexPipe* CreateDuplexPipe(size_t buffer_size);
 void        DestroyDuplexPipe(DuplexPipe *pipe);
-void		Run(DuplexPipe *self);
+double		Run(DuplexPipe *self);
 
 #endif // DUPLEX_PIPE_H
@@ -0,0 +1,55 @@
+#ifndef DUPLEX_POOL_H
+#define DUPLEX_POOL_H
+
+#include <sys/types.h>
+
+#include "duplex_pipe.h"
+#include "buffer_pool.h"
+
+typedef enum {
+    DISPATCH_ROUND_ROBIN,
+    DISPATCH_LEAST_LOADED,
+} DispatchPolicy;
+
+typedef struct PoolChunk {
+        Buffer* buf;            // one reference for the send side, one for the output writer
+        size_t  len;            // bytes read from input into this chunk
+        size_t  sent;           // bytes already written to the worker
+        size_t  recvd;          // bytes already echoed back by the worker
+        uint64_t sent_at;       // dispatch time, ns
+} PoolChunk;
+
+typedef struct PoolWorker {
+        DuplexPipe* pipe;
+        pid_t       pid;
+        size_t*     queue;      // ring of chunk sequence numbers assigned to this worker (FIFO)
+        size_t      head;       // next chunk to receive back
+        size_t      send_pos;   // next chunk to send
+        size_t      tail;       // next free queue entry
+        size_t      load;       // bytes in flight
+        int         out_armed;  // EPOLLOUT is registered for the write end
+} PoolWorker;
+
+typedef struct DuplexPool {
+        PoolWorker*     workers;
+        size_t          n_workers;
+        PoolChunk*      chunks;     // chunk with sequence number s lives in chunks[s % n_chunks]
+        BufferPool*     buffers;    // n_workers * depth, half the slots: bounds the chunks not yet written out
+        size_t          n_chunks;
+        size_t          chunk_size;
+        size_t          depth;      // max chunks in flight per worker
+        DispatchPolicy  policy;
+        size_t          next_rr;
+        int             epfd;
+        Histogram*      latency;    // optional, dispatch-to-echo latency of every chunk
+} DuplexPool;
+
+/*
+    forks n echo workers, each with its own DuplexPipe.
+    Chunks are handed out by policy and written to "out" in input order.
+*/
+DuplexPool* CreateDuplexPool(size_t n, size_t chunk_size, size_t depth, DispatchPolicy policy);
+void        DestroyDuplexPool(DuplexPool *pool);
+ssize_t     RunPool(DuplexPool *pool, int in, int out);
+
+#endif // DUPLEX_POOL_H
@@ -0,0 +1,34 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+    HDR-style log-linear histogram: values below 2^HIST_SUB_BITS are counted exactly,
+    above that every power of two is split into 2^(HIST_SUB_BITS - 1) buckets (~1.6% precision).
+    All buckets are preallocated, recording is a relaxed atomic increment.
+*/
+#define HIST_SUB_BITS       7
+#define HIST_HALF           (1u << (HIST_SUB_BITS - 1))
+#define HIST_NUM_BUCKETS    ((66 - HIST_SUB_BITS) * HIST_HALF)
+
+typedef struct Histogram {
+        _Atomic uint64_t    counts[HIST_NUM_BUCKETS];
+        _Atomic uint64_t    total;
+        _Atomic uint64_t    min;
+        _Atomic uint64_t    max;
+} Histogram;
+
+Histogram*  CreateHistogram     (void);
+void        DestroyHistogram    (Histogram *hist);
+void        ResetHistogram      (Histogram *hist);
+
+void        HistogramRecord     (Histogram *hist, uint64_t value);
+uint64_t    HistogramPercentile (const Histogram *hist, double percentile);
+void        HistogramPrint      (const Histogram *hist, const char *title);
+int         HistogramDumpCsv    (const Histogram *hist, const char *path);
+
+uint64_t    GetTimeNs           (void);
+
+#endif // HISTOGRAM_H
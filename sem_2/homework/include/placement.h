@@ -0,0 +1,26 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+typedef enum {
+    PLACE_NONE,             // left to the scheduler
+    PLACE_SAME_CORE,        // parent and child share one logical CPU
+    PLACE_SMT_SIBLINGS,     // two hyperthreads of one physical core
+    PLACE_SAME_SOCKET,      // different physical cores of one package
+    PLACE_CROSS_SOCKET,     // different packages (NUMA nodes)
+    PLACE_COUNT,
+} Placement;
+
+typedef struct CpuPair {
+    int parent;
+    int child;
+} CpuPair;
+
+/*
+    picks logical CPUs for the parent and the child from
+    /sys/devices/system/cpu/cpuN/topology, returns -1 if the machine has no such pair
+*/
+int         ResolvePlacement    (Placement place, CpuPair *cpus);
+int         PinToCpu            (int cpu);
+const char* PlacementName       (Placement place);
+
+#endif // PLACEMENT_H
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <buffer_pool.h>
+
+#define FREE_LIST_END UINT32_MAX
+
+static uint64_t PackHead(uint64_t tag, uint32_t index) {
+    return (tag << 32) | index;
+}
+
+static void PushFree(BufferPool *pool, uint32_t index) {
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_relaxed);
+    uint64_t next = 0;
+
+    do {
+        atomic_store_explicit(&pool->next[index], (uint32_t)head, memory_order_relaxed);
+        next = PackHead((head >> 32) + 1, index);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &head, next,
+                                                    memory_order_release, memory_order_relaxed));
+
+    atomic_fetch_add_explicit(&pool->available, 1, memory_order_relaxed);
+}
+
+static uint32_t PopFree(BufferPool *pool) {
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_acquire);
+    uint64_t next = 0;
+
+    do {
+        uint32_t index = (uint32_t)head;
+        if (index == FREE_LIST_END) return FREE_LIST_END;
+
+        next = PackHead((head >> 32) + 1, atomic_load_explicit(&pool->next[index], memory_order_relaxed));
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &head, next,
+                                                    memory_order_acquire, memory_order_acquire));
+
+    atomic_fetch_sub_explicit(&pool->available, 1, memory_order_relaxed);
+    return (uint32_t)head;
+}
+
+BufferPool* CreateBufferPool(size_t count, size_t buf_size, size_t align) {
+    if (count == 0 || count >= FREE_LIST_END || buf_size == 0 ||
+        align == 0 || (align & (align - 1)) != 0) {
+        fprintf(stderr, "invalid buffer pool parameters\n");
+        return NULL;
+    }
+
+    BufferPool *pool = (BufferPool*)calloc(1, sizeof(BufferPool));
+    if (pool == NULL) {
+        fprintf(stderr, "failed to allocate memory for BufferPool\n");
+        return NULL;
+    }
+
+    /* every buffer starts on an "align" boundary */
+    size_t stride = (buf_size + align - 1) & ~(align - 1);
+
+    pool->count    = count;
+    pool->buf_size = buf_size;
+    pool->bufs     = (Buffer*)calloc(count, sizeof(Buffer));
+    pool->next     = (_Atomic uint32_t*)calloc(count, sizeof(*pool->next));
+    pool->mem      = (char*)aligned_alloc(align, count * stride);
+    if (pool->bufs == NULL || pool->next == NULL || pool->mem == NULL) {
+        fprintf(stderr, "failed to allocate memory for buffers\n");
+        DestroyBufferPool(pool);
+        return NULL;
+    }
+
+    atomic_init(&pool->free_head, PackHead(0, FREE_LIST_END));
+    atomic_init(&pool->available, 0);
+
+    for (size_t i = count; i-- > 0;) {
+        pool->bufs[i].data  = pool->mem + i * stride;
+        pool->bufs[i].size  = buf_size;
+        pool->bufs[i].index = (uint32_t)i;
+        atomic_init(&pool->bufs[i].refs, 0);
+
+        PushFree(pool, (uint32_t)i);
+    }
+
+    return pool;
+}
+
+void DestroyBufferPool(BufferPool *pool) {
+    if (pool == NULL) return;
+
+    free(pool->mem);
+    free(pool->next);
+    free(pool->bufs);
+    free(pool);
+}
+
+/* returns a buffer with one reference or NULL if all of them are in flight */
+Buffer* BufferAcquire(BufferPool *pool) {
+    assert(pool);
+
+    uint32_t index = PopFree(pool);
+    if (index == FREE_LIST_END) return NULL;
+
+    Buffer *buf = &pool->bufs[index];
+    buf->len = 0;
+    atomic_store_explicit(&buf->refs, 1, memory_order_relaxed);
+
+    return buf;
+}
+
+void BufferRetain(Buffer *buf) {
+    assert(buf);
+
+    atomic_fetch_add_explicit(&buf->refs, 1, memory_order_relaxed);
+}
+
+void BufferRelease(BufferPool *pool, Buffer *buf) {
+    assert(pool);
+    assert(buf);
+
+    uint32_t refs = atomic_fetch_sub_explicit(&buf->refs, 1, memory_order_acq_rel);
+    assert(refs > 0);
+
+    if (refs == 1) PushFree(pool, buf->index);
+}
+
+size_t BufferPoolAvailable(const BufferPool *pool) {
+    assert(pool);
+
+    return atomic_load_explicit(&pool->available, memory_order_relaxed);
+}
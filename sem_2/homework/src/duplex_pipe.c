@@ -1,52 +1,230 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <duplex_pipe.h>
-
-const size_t MAX_BUF_SIZE = 1 << 16; // 65536
+#include <placement.h>
 
 static ssize_t ReadDuplex(DuplexPipe *pipe) {
     assert(pipe);
 
-    return read(pipe->fd_direct[0], pipe->data, MAX_BUF_SIZE);
+    return read(pipe->fd_rd, pipe->data, pipe->data_size);
 }
 
 static ssize_t WriteDuplex(DuplexPipe *pipe) {
     assert(pipe);
 
-    return write(pipe->fd_back[1], pipe->data, pipe->len);
+    return write(pipe->fd_wr, pipe->data, pipe->len);
+}
+
+/*
+    sends header + payload (data, len) in one writev(),
+    empty messages are not allowed so that rcv_msg() == 0 always means EOF
+*/
+static ssize_t SendMsg(DuplexPipe *pipe) {
+    assert(pipe);
+
+    if (pipe->len == 0 || pipe->len > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    MsgHeader hdr = { .len = (uint32_t)pipe->len };
+
+    struct iovec iov[2] = {
+        { .iov_base = &hdr,       .iov_len = sizeof(hdr) },
+        { .iov_base = pipe->data, .iov_len = pipe->len   },
+    };
+    struct iovec *cur = iov;
+    int           cnt = 2;
+
+    while (cnt > 0) {
+        ssize_t n = writev(pipe->fd_wr, cur, cnt);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        size_t done = (size_t)n;
+        while (cnt > 0 && done >= cur->iov_len) {
+            done -= cur->iov_len;
+            cur++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            cur->iov_base = (char*)cur->iov_base + done;
+            cur->iov_len -= done;
+        }
+    }
+
+    return (ssize_t)pipe->len;
+}
+
+/* takes up to "size" bytes from the read-ahead buffer */
+static size_t TakeSpill(DuplexPipe *pipe, void *dst, size_t size) {
+    size_t n = (pipe->spill_len < size) ? pipe->spill_len : size;
+    if (n == 0) return 0;
+
+    memcpy(dst, pipe->spill, n);
+    pipe->spill_len -= n;
+    memmove(pipe->spill, pipe->spill + n, pipe->spill_len);
+
+    return n;
+}
+
+/*
+    receives one message into data, sets len.
+    Header and the first part of the payload come in one readv(), bytes
+    of the following message read by it are kept in spill for the next call.
+    Returns payload length, 0 on EOF, -1 on error or truncated message.
+*/
+static ssize_t RecvMsg(DuplexPipe *pipe) {
+    assert(pipe);
+
+    MsgHeader hdr     = {0};
+    size_t    hdr_got = TakeSpill(pipe, &hdr, sizeof(hdr));
+    size_t    got     = 0;
+
+    while (hdr_got < sizeof(hdr)) {
+        struct iovec iov[2] = {
+            { .iov_base = (char*)&hdr + hdr_got, .iov_len = sizeof(hdr) - hdr_got },
+            { .iov_base = pipe->data,            .iov_len = pipe->data_size       },
+        };
+
+        ssize_t n = readv(pipe->fd_rd, iov, 2);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        } else if (n == 0) {
+            if (hdr_got == 0) return 0;
+            errno = EPROTO;
+            return -1;
+        }
+
+        if ((size_t)n < sizeof(hdr) - hdr_got) {
+            hdr_got += (size_t)n;
+        } else {
+            got     = (size_t)n - (sizeof(hdr) - hdr_got);
+            hdr_got = sizeof(hdr);
+        }
+    }
+
+    if (hdr.len == 0 || hdr.len > pipe->data_size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (got > hdr.len) {
+        /* read-ahead only happens with an empty spill, so it fits */
+        memcpy(pipe->spill, pipe->data + hdr.len, got - hdr.len);
+        pipe->spill_len = got - hdr.len;
+        got = hdr.len;
+    } else if (got == 0) {
+        got = TakeSpill(pipe, pipe->data, hdr.len);
+    }
+
+    while (got < hdr.len) {
+        ssize_t n = read(pipe->fd_rd, pipe->data + got, hdr.len - got);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        } else if (n == 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        got += (size_t)n;
+    }
+
+    pipe->len = hdr.len;
+    return (ssize_t)hdr.len;
+}
+
+static void CloseFd(int *fd) {
+    if (*fd != -1) {
+        close(*fd);
+        *fd = -1;
+    }
 }
 
+/*
+    called in the parent: drop the child's ends,
+    parent writes to fd_direct[1] and reads from fd_back[0]
+*/
 static void CloseParentPipes(DuplexPipe *self) {
     assert(self);
 
-    close(self->fd_direct[0]);
-    close(self->fd_back[1]);
+    CloseFd(&self->fd_direct[0]);
+    CloseFd(&self->fd_back[1]);
+
+    self->fd_rd = self->fd_back[0];
+    self->fd_wr = self->fd_direct[1];
 }
 
+/*
+    called in the child: drop the parent's ends,
+    child reads from fd_direct[0] and writes to fd_back[1]
+*/
 static void CloseChildPipes(DuplexPipe *self) {
     assert(self);
 
-    close(self->fd_direct[1]);
-    close(self->fd_back[0]);
+    CloseFd(&self->fd_direct[1]);
+    CloseFd(&self->fd_back[0]);
+
+    self->fd_rd = self->fd_direct[0];
+    self->fd_wr = self->fd_back[1];
 }
 
 static void CloseAllPipes(DuplexPipe *self) {
     assert(self);
 
-    close(self->fd_direct[0]);
-    close(self->fd_direct[1]);
-    close(self->fd_back[0]);
-    close(self->fd_back[1]);
+    CloseFd(&self->fd_direct[0]);
+    CloseFd(&self->fd_direct[1]);
+    CloseFd(&self->fd_back[0]);
+    CloseFd(&self->fd_back[1]);
+
+    self->fd_rd = -1;
+    self->fd_wr = -1;
+}
+
+/*
+    pins the calling process and replaces its buffers with ones first touched
+    there: the pages of the old ones were placed by whoever touched them before fork
+*/
+static int PinWithBuffers(DuplexPipe *self, int cpu) {
+    assert(self);
+
+    if (cpu < 0) return 0;
+    if (PinToCpu(cpu) == -1) return -1;
+
+    char *data  = (char*)malloc(self->data_size);
+    char *spill = (char*)malloc(self->data_size);
+    if (data == NULL || spill == NULL) {
+        free(data);
+        free(spill);
+        return -1;
+    }
+
+    memset(data,  0, self->data_size);
+    memcpy(spill, self->spill, self->spill_len);
+    memset(spill + self->spill_len, 0, self->data_size - self->spill_len);
+
+    free(self->data);
+    free(self->spill);
+    self->data  = data;
+    self->spill = spill;
+
+    return 0;
 }
 
-void Run(DuplexPipe *self) {
+/* echo test over parent.txt -> child.txt, returns elapsed time in seconds or -1 */
+double Run(DuplexPipe *self) {
     assert(self);
 
     pid_t pid = -1;
@@ -56,7 +234,7 @@ void Run(DuplexPipe *self) {
 
     if ((pid = fork()) == -1) {
         fprintf(stderr, "failed to create new process\n");
-        return;
+        return -1.0;
     } else if (pid == 0) {
         /*
             no write in parent -> child
@@ -64,36 +242,45 @@ void Run(DuplexPipe *self) {
         */
         self->actions.close_child(self);
 
-        ssize_t n;
-        while ((n = self->actions.rcv(self)) > 0) {
-            self->len = (size_t)n;
-            self->actions.snd(self);
+        if (PinWithBuffers(self, self->child_cpu) == -1) {
+            fprintf(stderr, "failed to pin child to cpu %d\n", self->child_cpu);
+        }
+
+        while (self->actions.rcv_msg(self) > 0) {
+            if (self->actions.snd_msg(self) == -1) break;
         }
 
 		self->actions.close_all(self);
 
-        exit(0);
+        _exit(0);
     } else {
         self->actions.close_parent(self);
 
+        if (PinWithBuffers(self, self->parent_cpu) == -1) {
+            fprintf(stderr, "failed to pin parent to cpu %d\n", self->parent_cpu);
+        }
+
         int in  = open("parent.txt", O_RDONLY);
         if (in == -1) {
             fprintf(stderr, "failed to open parent file\n");
-            return;
+            return -1.0;
         }
 
         int out = open("child.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
         if (out == -1) {
             fprintf(stderr, "failed to open child file\n");
             close(in);
-            return;
+            return -1.0;
         }
 
         ssize_t len = 0;
-        while ((len = read(in, self->data, MAX_BUF_SIZE)) > 0) {
+        while ((len = read(in, self->data, self->data_size)) > 0) {
             self->len = (size_t)len;
-            if (self->actions.snd(self) != len) break;
-            if (self->actions.rcv(self) != len) break;
+
+            uint64_t sent_at = (self->latency != NULL) ? GetTimeNs() : 0;
+            if (self->actions.snd_msg(self) != len) break;
+            if (self->actions.rcv_msg(self) != len) break;
+            if (self->latency != NULL) HistogramRecord(self->latency, GetTimeNs() - sent_at);
             write(out, self->data, (size_t)len);
         }
 
@@ -117,7 +304,7 @@ void Run(DuplexPipe *self) {
 	time_taken = (double)(end.tv_sec - start.tv_sec) * 1e9;
     time_taken = (time_taken + (double)(end.tv_nsec - start.tv_nsec)) * 1e-9;
 
-	printf("Time duration: %lg\n", time_taken);
+    return time_taken;
 }
 
 DuplexPipe* CreateDuplexPipe(size_t buffer_size) {
@@ -129,12 +316,29 @@ DuplexPipe* CreateDuplexPipe(size_t buffer_size) {
 
     self->data = (char*)calloc(buffer_size, sizeof(char));
     if (self->data == NULL) {
-        fprintf(stderr, "failed to allocate memory for data");
+        fprintf(stderr, "failed to allocate memory for data\n");
+        free(self);
+        return NULL;
+    }
+    self->data_size = buffer_size;
+
+    self->spill = (char*)calloc(buffer_size, sizeof(char));
+    if (self->spill == NULL) {
+        fprintf(stderr, "failed to allocate memory for spill buffer\n");
+        free(self->data);
+        free(self);
         return NULL;
     }
 
+    self->fd_direct[0] = self->fd_direct[1] = -1;
+    self->fd_back[0]   = self->fd_back[1]   = -1;
+    self->fd_rd        = self->fd_wr        = -1;
+    self->parent_cpu   = self->child_cpu    = -1;
+
     if (pipe(self->fd_direct) == -1 || pipe(self->fd_back) == -1) {
         fprintf(stderr, "failed to initialize pipe\n");
+        CloseAllPipes(self);
+        free(self->spill);
         free(self->data);
         free(self);
 
@@ -143,6 +347,8 @@ DuplexPipe* CreateDuplexPipe(size_t buffer_size) {
 
     self->actions.rcv = ReadDuplex;
     self->actions.snd = WriteDuplex;
+    self->actions.rcv_msg = RecvMsg;
+    self->actions.snd_msg = SendMsg;
     self->actions.close_child = CloseChildPipes;
     self->actions.close_parent = CloseParentPipes;
     self->actions.close_all = CloseAllPipes;
@@ -153,12 +359,9 @@ DuplexPipe* CreateDuplexPipe(size_t buffer_size) {
 void DestroyDuplexPipe(DuplexPipe *self) {
     if (self == NULL) return;
 
-    close(self->fd_direct[0]);
-    close(self->fd_direct[1]);
-
-    close(self->fd_back[0]);
-    close(self->fd_back[1]);
+    CloseAllPipes(self);
 
+    free(self->spill);
     free(self->data);
     free(self);
 }
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+
+#include <duplex_pool.h>
+
+#define POOL_MAX_EVENTS 64
+#define POOL_BUF_ALIGN  4096
+
+static void EchoWorker(DuplexPipe *self) {
+    assert(self);
+
+    ssize_t n;
+    while ((n = self->actions.rcv(self)) > 0) {
+        self->len = (size_t)n;
+        self->actions.snd(self);
+    }
+
+    self->actions.close_all(self);
+}
+
+static ssize_t WriteAll(int fd, const char *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, buf + done, len - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += (size_t)n;
+    }
+
+    return (ssize_t)done;
+}
+
+static int SetNonBlock(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) return -1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/*
+    epoll user data: worker index in the upper bits,
+    lowest bit tells the direction (0 - read end, 1 - write end)
+*/
+static int ArmOut(DuplexPool *pool, size_t idx, int on) {
+    PoolWorker *w = &pool->workers[idx];
+    if (w->out_armed == on) return 0;
+
+    struct epoll_event ev = {0};
+    ev.events   = on ? EPOLLOUT : 0;
+    ev.data.u64 = (idx << 1) | 1;
+    if (epoll_ctl(pool->epfd, EPOLL_CTL_MOD, w->pipe->fd_wr, &ev) == -1) {
+        fprintf(stderr, "failed to modify epoll for worker %zu\n", idx);
+        return -1;
+    }
+    w->out_armed = on;
+
+    return 0;
+}
+
+static PoolWorker* PickWorker(DuplexPool *pool, size_t *idx) {
+    if (pool->policy == DISPATCH_ROUND_ROBIN) {
+        PoolWorker *w = &pool->workers[pool->next_rr];
+        if (w->tail - w->head == pool->depth) return NULL;
+
+        *idx = pool->next_rr;
+        pool->next_rr = (pool->next_rr + 1) % pool->n_workers;
+        return w;
+    }
+
+    PoolWorker *best = NULL;
+    for (size_t i = 0; i < pool->n_workers; i++) {
+        PoolWorker *w = &pool->workers[i];
+        if (w->tail - w->head == pool->depth) continue;
+        if (best == NULL || w->load < best->load) {
+            best = w;
+            *idx = i;
+        }
+    }
+
+    return best;
+}
+
+/* the worker hung up (exited or closed its end): its chunks are lost, stop watching its pipe */
+static void DropWorker(DuplexPool *pool, size_t idx) {
+    PoolWorker *w = &pool->workers[idx];
+
+    fprintf(stderr, "worker %zu hung up with %zu chunks in flight\n", idx, w->tail - w->head);
+
+    if (epoll_ctl(pool->epfd, EPOLL_CTL_DEL, w->pipe->fd_rd, NULL) == -1 ||
+        epoll_ctl(pool->epfd, EPOLL_CTL_DEL, w->pipe->fd_wr, NULL) == -1) {
+        fprintf(stderr, "failed to remove worker %zu from epoll\n", idx);
+    }
+}
+
+/* pushes queued chunks to the worker until the pipe is full */
+static int PumpOut(DuplexPool *pool, size_t idx) {
+    PoolWorker *w = &pool->workers[idx];
+
+    while (w->send_pos != w->tail) {
+        size_t     seq   = w->queue[w->send_pos % pool->depth];
+        PoolChunk *chunk = &pool->chunks[seq % pool->n_chunks];
+
+        ssize_t n = write(w->pipe->fd_wr, chunk->buf->data + chunk->sent, chunk->len - chunk->sent);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EINTR) return 0;
+            if (errno == EPIPE) {
+                DropWorker(pool, idx);
+                return -1;
+            }
+            fprintf(stderr, "failed to write to worker %zu\n", idx);
+            return -1;
+        }
+
+        chunk->sent += (size_t)n;
+        if (chunk->sent == chunk->len) {
+            /* the send side's reference, the output writer keeps its own until the echo is written */
+            BufferRelease(pool->buffers, chunk->buf);
+            w->send_pos++;
+        }
+    }
+
+    return ArmOut(pool, idx, 0);
+}
+
+/* drains echoed bytes into the chunks in the order they were sent */
+static int PumpIn(DuplexPool *pool, size_t idx) {
+    PoolWorker *w = &pool->workers[idx];
+
+    while (w->head != w->tail) {
+        size_t     seq   = w->queue[w->head % pool->depth];
+        PoolChunk *chunk = &pool->chunks[seq % pool->n_chunks];
+
+        ssize_t n = read(w->pipe->fd_rd, chunk->buf->data + chunk->recvd, chunk->len - chunk->recvd);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EINTR) return 0;
+            fprintf(stderr, "failed to read from worker %zu\n", idx);
+            return -1;
+        } else if (n == 0) {
+            fprintf(stderr, "worker %zu closed its pipe unexpectedly\n", idx);
+            return -1;
+        }
+
+        chunk->recvd += (size_t)n;
+        if (chunk->recvd == chunk->len) {
+            if (pool->latency != NULL) HistogramRecord(pool->latency, GetTimeNs() - chunk->sent_at);
+            w->load -= chunk->len;
+            w->head++;
+        }
+    }
+
+    return 0;
+}
+
+ssize_t RunPool(DuplexPool *pool, int in, int out) {
+    assert(pool);
+
+    struct epoll_event events[POOL_MAX_EVENTS];
+
+    size_t  next_seq = 0;   // sequence number of the next chunk read from input
+    size_t  next_out = 0;   // sequence number of the next chunk written to output
+    size_t  total    = 0;
+    int     eof      = 0;
+
+    while (!eof || next_out != next_seq) {
+        while (!eof && next_seq - next_out < pool->n_chunks) {
+            size_t idx = 0;
+            PoolWorker *w = PickWorker(pool, &idx);
+            if (w == NULL) break;
+
+            /* all buffers in flight or waiting to be written out: wait for the output to free one */
+            PoolChunk *chunk = &pool->chunks[next_seq % pool->n_chunks];
+            if (chunk->buf == NULL) chunk->buf = BufferAcquire(pool->buffers);
+            if (chunk->buf == NULL) break;
+
+            ssize_t len = read(in, chunk->buf->data, pool->chunk_size);
+            if (len == -1) {
+                if (errno == EINTR) continue;
+                fprintf(stderr, "failed to read input\n");
+                return -1;
+            } else if (len == 0) {
+                eof = 1;
+                break;
+            }
+
+            chunk->buf->len = (size_t)len;
+            chunk->len   = (size_t)len;
+            chunk->sent  = 0;
+            chunk->recvd = 0;
+            if (pool->latency != NULL) chunk->sent_at = GetTimeNs();
+
+            BufferRetain(chunk->buf);
+            w->queue[w->tail++ % pool->depth] = next_seq++;
+            w->load += (size_t)len;
+
+            if (PumpOut(pool, idx) == -1) return -1;
+            if (w->send_pos != w->tail && ArmOut(pool, idx, 1) == -1) return -1;
+        }
+
+        if (next_out == next_seq) continue;
+
+        int n = epoll_wait(pool->epfd, events, POOL_MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "epoll_wait failed\n");
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            size_t idx = (size_t)(events[i].data.u64 >> 1);
+
+            /*
+                reported even when not requested: left registered, the fd would wake every epoll_wait.
+                Checked first, a write to the hung-up worker would only fail with EPIPE
+            */
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                DropWorker(pool, idx);
+                return -1;
+            }
+
+            int res = (events[i].data.u64 & 1) ? PumpOut(pool, idx) : PumpIn(pool, idx);
+            if (res == -1) return -1;
+        }
+
+        while (next_out != next_seq) {
+            PoolChunk *chunk = &pool->chunks[next_out % pool->n_chunks];
+            if (chunk->recvd != chunk->len) break;
+
+            if (WriteAll(out, chunk->buf->data, chunk->len) == -1) {
+                fprintf(stderr, "failed to write output\n");
+                return -1;
+            }
+            total += chunk->len;
+            next_out++;
+
+            BufferRelease(pool->buffers, chunk->buf);
+            chunk->buf = NULL;
+        }
+    }
+
+    return (ssize_t)total;
+}
+
+DuplexPool* CreateDuplexPool(size_t n, size_t chunk_size, size_t depth, DispatchPolicy policy) {
+    if (n == 0 || chunk_size == 0 || depth == 0) {
+        fprintf(stderr, "invalid pool parameters\n");
+        return NULL;
+    }
+
+    DuplexPool* pool = (DuplexPool*)calloc(1, sizeof(DuplexPool));
+    if (pool == NULL) {
+        fprintf(stderr, "failed to allocate memory for DuplexPool\n");
+        return NULL;
+    }
+
+    pool->n_workers  = n;
+    pool->chunk_size = chunk_size;
+    pool->depth      = depth;
+    pool->n_chunks   = 2 * n * depth;
+    pool->policy     = policy;
+    pool->epfd       = -1;
+
+    pool->workers = (PoolWorker*)calloc(n, sizeof(PoolWorker));
+    pool->chunks  = (PoolChunk*) calloc(pool->n_chunks, sizeof(PoolChunk));
+    pool->buffers = CreateBufferPool(n * depth, chunk_size, POOL_BUF_ALIGN);
+    if (pool->workers == NULL || pool->chunks == NULL || pool->buffers == NULL) {
+        fprintf(stderr, "failed to allocate memory for pool buffers\n");
+        DestroyDuplexPool(pool);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        pool->workers[i].pid   = -1;
+        pool->workers[i].queue = (size_t*)calloc(depth, sizeof(size_t));
+        pool->workers[i].pipe  = CreateDuplexPipe(chunk_size);
+        if (pool->workers[i].queue == NULL || pool->workers[i].pipe == NULL) {
+            fprintf(stderr, "failed to create worker %zu\n", i);
+            DestroyDuplexPool(pool);
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            fprintf(stderr, "failed to create new process\n");
+            DestroyDuplexPool(pool);
+            return NULL;
+        } else if (pid == 0) {
+            /*
+                the child must not keep the other workers' pipes open,
+                otherwise they never see EOF
+            */
+            for (size_t j = 0; j < n; j++) {
+                DuplexPipe *p = pool->workers[j].pipe;
+                if (j == i) p->actions.close_child(p);
+                else        p->actions.close_all(p);
+            }
+
+            EchoWorker(pool->workers[i].pipe);
+            _exit(0);
+        }
+
+        pool->workers[i].pid = pid;
+    }
+
+    /* a worker that exits must show up as EPIPE in PumpOut, not kill the parent; workers keep the default */
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        fprintf(stderr, "failed to ignore SIGPIPE\n");
+        DestroyDuplexPool(pool);
+        return NULL;
+    }
+
+    pool->epfd = epoll_create1(0);
+    if (pool->epfd == -1) {
+        fprintf(stderr, "failed to create epoll instance\n");
+        DestroyDuplexPool(pool);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        DuplexPipe *p = pool->workers[i].pipe;
+        p->actions.close_parent(p);
+
+        struct epoll_event ev_in  = {0};
+        struct epoll_event ev_out = {0};
+        ev_in.events    = EPOLLIN;
+        ev_in.data.u64  = (i << 1);
+        ev_out.events   = 0;
+        ev_out.data.u64 = (i << 1) | 1;
+
+        if (SetNonBlock(p->fd_rd) == -1 || SetNonBlock(p->fd_wr) == -1 ||
+            epoll_ctl(pool->epfd, EPOLL_CTL_ADD, p->fd_rd, &ev_in)  == -1 ||
+            epoll_ctl(pool->epfd, EPOLL_CTL_ADD, p->fd_wr, &ev_out) == -1) {
+            fprintf(stderr, "failed to register worker %zu in epoll\n", i);
+            DestroyDuplexPool(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void DestroyDuplexPool(DuplexPool *pool) {
+    if (pool == NULL) return;
+
+    if (pool->epfd != -1) close(pool->epfd);
+
+    if (pool->workers != NULL) {
+        /* closing the write ends lets the workers see EOF and exit */
+        for (size_t i = 0; i < pool->n_workers; i++) {
+            DestroyDuplexPipe(pool->workers[i].pipe);
+            free(pool->workers[i].queue);
+        }
+
+        for (size_t i = 0; i < pool->n_workers; i++) {
+            if (pool->workers[i].pid <= 0) continue;
+
+            int status = 0;
+            waitpid(pool->workers[i].pid, &status, 0);
+            if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+                printf("Worker %zu exited with code %d\n", i, WEXITSTATUS(status));
+            }
+        }
+    }
+
+    free(pool->workers);
+    if (pool->chunks != NULL && pool->buffers != NULL) {
+        for (size_t i = 0; i < pool->n_chunks; i++) {
+            PoolChunk *chunk = &pool->chunks[i];
+            if (chunk->buf == NULL) continue;
+
+            /* a chunk not sent completely still has the send side's reference */
+            if (chunk->sent < chunk->len) BufferRelease(pool->buffers, chunk->buf);
+            BufferRelease(pool->buffers, chunk->buf);
+        }
+    }
+
+    free(pool->chunks);
+    DestroyBufferPool(pool->buffers);
+    free(pool);
+}
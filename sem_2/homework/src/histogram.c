@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include <time.h>
+
+#include <histogram.h>
+
+static size_t BucketIndex(uint64_t value) {
+    if (value < (1u << HIST_SUB_BITS)) return (size_t)value;
+
+    unsigned msb   = 63u - (unsigned)__builtin_clzll(value);
+    unsigned shift = msb - HIST_SUB_BITS + 1;
+
+    return (size_t)shift * HIST_HALF + (size_t)(value >> shift);
+}
+
+/* highest value that falls into the bucket */
+static uint64_t BucketValue(size_t idx) {
+    if (idx < (1u << HIST_SUB_BITS)) return idx;
+
+    unsigned shift = (unsigned)(idx / HIST_HALF) - 1;
+    uint64_t sub   = (uint64_t)(idx - (size_t)shift * HIST_HALF);
+
+    return ((sub + 1) << shift) - 1;
+}
+
+Histogram* CreateHistogram(void) {
+    Histogram *hist = (Histogram*)calloc(1, sizeof(Histogram));
+    if (hist == NULL) {
+        fprintf(stderr, "failed to allocate memory for Histogram\n");
+        return NULL;
+    }
+
+    ResetHistogram(hist);
+    return hist;
+}
+
+void DestroyHistogram(Histogram *hist) {
+    free(hist);
+}
+
+void ResetHistogram(Histogram *hist) {
+    assert(hist);
+
+    for (size_t i = 0; i < HIST_NUM_BUCKETS; i++) {
+        atomic_store_explicit(&hist->counts[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&hist->total, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->min, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&hist->max, 0, memory_order_relaxed);
+}
+
+void HistogramRecord(Histogram *hist, uint64_t value) {
+    assert(hist);
+
+    atomic_fetch_add_explicit(&hist->counts[BucketIndex(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->total, 1, memory_order_relaxed);
+
+    uint64_t cur = atomic_load_explicit(&hist->min, memory_order_relaxed);
+    while (value < cur &&
+           !atomic_compare_exchange_weak_explicit(&hist->min, &cur, value,
+                                                  memory_order_relaxed, memory_order_relaxed));
+
+    cur = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    while (value > cur &&
+           !atomic_compare_exchange_weak_explicit(&hist->max, &cur, value,
+                                                  memory_order_relaxed, memory_order_relaxed));
+}
+
+uint64_t HistogramPercentile(const Histogram *hist, double percentile) {
+    assert(hist);
+
+    uint64_t total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+    if (total == 0) return 0;
+
+    uint64_t target = (uint64_t)ceil(percentile / 100.0 * (double)total);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_NUM_BUCKETS; i++) {
+        seen += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+        if (seen >= target) {
+            uint64_t value = BucketValue(i);
+            uint64_t max   = atomic_load_explicit(&hist->max, memory_order_relaxed);
+            return (value < max) ? value : max;
+        }
+    }
+
+    return atomic_load_explicit(&hist->max, memory_order_relaxed);
+}
+
+void HistogramPrint(const Histogram *hist, const char *title) {
+    assert(hist);
+
+    uint64_t total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+    if (total == 0) {
+        printf("%s: no samples\n", title);
+        return;
+    }
+
+    printf("%s (%" PRIu64 " samples, ns): min %" PRIu64 "  p50 %" PRIu64 "  p90 %" PRIu64
+           "  p99 %" PRIu64 "  p99.9 %" PRIu64 "  max %" PRIu64 "\n",
+           title, total,
+           atomic_load_explicit(&hist->min, memory_order_relaxed),
+           HistogramPercentile(hist, 50.0),
+           HistogramPercentile(hist, 90.0),
+           HistogramPercentile(hist, 99.0),
+           HistogramPercentile(hist, 99.9),
+           atomic_load_explicit(&hist->max, memory_order_relaxed));
+}
+
+/* one line per non-empty bucket: upper bound, count, cumulative percentile */
+int HistogramDumpCsv(const Histogram *hist, const char *path) {
+    assert(hist);
+    assert(path);
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return -1;
+    }
+
+    uint64_t total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+    uint64_t seen  = 0;
+
+    fprintf(file, "value_ns,count,percentile\n");
+    for (size_t i = 0; i < HIST_NUM_BUCKETS; i++) {
+        uint64_t count = atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+        if (count == 0) continue;
+
+        seen += count;
+        fprintf(file, "%" PRIu64 ",%" PRIu64 ",%.4lf\n", BucketValue(i), count,
+                100.0 * (double)seen / (double)total);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+uint64_t GetTimeNs(void) {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
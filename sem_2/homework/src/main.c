@@ -1,17 +1,174 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
 
 #include "file.h"
 #include "duplex_pipe.h"
+#include "duplex_pool.h"
+#include "histogram.h"
+#include "placement.h"
 
-int main() {
-    DuplexPipe *pipe = CreateDuplexPipe(65536);
+static const size_t BUFFER_SIZE = 65536;
+static const size_t POOL_DEPTH  = 4;
+
+static double GetTime(void) {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*
+    throughput of the echo pool for 1..<number of cores> workers,
+    every run copies parent.txt to child.txt through the pool
+*/
+static int BenchPool(DispatchPolicy policy) {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cores < 1) num_cores = 1;
+
+    Histogram *latency = CreateHistogram();
+    if (latency == NULL) return 1;
+
+    printf("%8s %12s %12s %12s %12s\n", "workers", "time, s", "MiB/s", "p50, us", "p99, us");
+
+    for (size_t n = 1; n <= (size_t)num_cores; n++) {
+        int in = open("parent.txt", O_RDONLY);
+        if (in == -1) {
+            fprintf(stderr, "failed to open parent file\n");
+            DestroyHistogram(latency);
+            return 1;
+        }
+
+        int out = open("child.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out == -1) {
+            fprintf(stderr, "failed to open child file\n");
+            close(in);
+            DestroyHistogram(latency);
+            return 1;
+        }
+
+        ResetHistogram(latency);
+        double start = GetTime();
+
+        DuplexPool *pool = CreateDuplexPool(n, BUFFER_SIZE, POOL_DEPTH, policy);
+        if (pool != NULL) pool->latency = latency;
+        ssize_t total = (pool != NULL) ? RunPool(pool, in, out) : -1;
+        DestroyDuplexPool(pool);
+
+        double duration = GetTime() - start;
+
+        close(in);
+        close(out);
+
+        if (total == -1) {
+            fprintf(stderr, "pool run with %zu workers failed\n", n);
+            DestroyHistogram(latency);
+            return 1;
+        }
+
+        printf("%8zu %12lg %12.1lf %12.1lf %12.1lf\n", n, duration, (double)total / (1 << 20) / duration,
+               (double)HistogramPercentile(latency, 50.0) * 1e-3,
+               (double)HistogramPercentile(latency, 99.0) * 1e-3);
+    }
+
+    DestroyHistogram(latency);
+    return 0;
+}
+
+/* echo test throughput for every parent/child placement the machine supports */
+static int BenchPlacement(void) {
+    int in = open("parent.txt", O_RDONLY);
+    if (in == -1) {
+        fprintf(stderr, "failed to open parent file\n");
+        return 1;
+    }
+    size_t file_size = GetFileSize(in);
+    close(in);
+
+    /* Run() pins this process, every placement starts from the mask it had before */
+    cpu_set_t saved;
+    CPU_ZERO(&saved);
+    if (sched_getaffinity(0, sizeof(saved), &saved) == -1) {
+        fprintf(stderr, "failed to get cpu affinity\n");
+        return 1;
+    }
+
+    printf("%14s %8s %8s %12s %12s\n", "placement", "parent", "child", "time, s", "MiB/s");
+
+    for (int i = 0; i < PLACE_COUNT; i++) {
+        Placement place = (Placement)i;
+        CpuPair   cpus  = {};
+
+        if (ResolvePlacement(place, &cpus) == -1) {
+            printf("%14s %8s %8s %12s %12s\n", PlacementName(place), "-", "-", "-", "skipped");
+            continue;
+        }
+
+        DuplexPipe *pipe = CreateDuplexPipe(BUFFER_SIZE);
+        if (pipe == NULL) {
+            fprintf(stderr, "failed to create DuplexPipe\n");
+            return 1;
+        }
+
+        pipe->parent_cpu = cpus.parent;
+        pipe->child_cpu  = cpus.child;
+        double duration  = Run(pipe);
+        DestroyDuplexPipe(pipe);
+
+        if (sched_setaffinity(0, sizeof(saved), &saved) == -1) {
+            fprintf(stderr, "failed to restore cpu affinity\n");
+            return 1;
+        }
+
+        if (duration < 0) return 1;
+
+        printf("%14s %8d %8d %12lg %12.1lf\n", PlacementName(place), cpus.parent, cpus.child,
+               duration, (double)file_size / (1 << 20) / duration);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "placement") == 0) {
+        return BenchPlacement();
+    }
+
+    if (argc > 1 && strcmp(argv[1], "pool") == 0) {
+        DispatchPolicy policy = DISPATCH_ROUND_ROBIN;
+        if (argc > 2 && strcmp(argv[2], "least-loaded") == 0) {
+            policy = DISPATCH_LEAST_LOADED;
+        }
+
+        return BenchPool(policy);
+    }
+
+    /* "latency [file.csv]": per round trip histogram of the echo test */
+    Histogram *latency = NULL;
+    if (argc > 1 && strcmp(argv[1], "latency") == 0) {
+        latency = CreateHistogram();
+        if (latency == NULL) return 1;
+    }
+
+    DuplexPipe *pipe = CreateDuplexPipe(BUFFER_SIZE);
     if (pipe == NULL) {
         fprintf(stderr, "failed to create DuplexPipe\n");
+        DestroyHistogram(latency);
         return 1;
     }
 
-    Run(pipe);
+    pipe->latency   = latency;
+    double duration = Run(pipe);
     DestroyDuplexPipe(pipe);
 
+    if (duration >= 0) printf("Time duration: %lg\n", duration);
+
+    if (latency != NULL) {
+        HistogramPrint(latency, "Round trip latency");
+        if (argc > 2) HistogramDumpCsv(latency, argv[2]);
+        DestroyHistogram(latency);
+    }
+
     return 0;
 }
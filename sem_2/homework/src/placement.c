@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <placement.h>
+
+static int ReadTopologyId(int cpu, const char *name) {
+    char path[128] = "";
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+
+    int id = -1;
+    if (fscanf(file, "%d", &id) != 1) id = -1;
+    fclose(file);
+
+    return id;
+}
+
+static int CpuOnline(int cpu) {
+    if (cpu == 0) return 1;     // cpu0 usually has no "online" file
+
+    char path[128] = "";
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/online", cpu);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 1;
+
+    int online = 1;
+    if (fscanf(file, "%d", &online) != 1) online = 1;
+    fclose(file);
+
+    return online;
+}
+
+static int Matches(Placement place, int core_a, int pkg_a, int core_b, int pkg_b) {
+    switch (place) {
+        case PLACE_SMT_SIBLINGS:    return pkg_a == pkg_b && core_a == core_b;
+        case PLACE_SAME_SOCKET:     return pkg_a == pkg_b && core_a != core_b;
+        case PLACE_CROSS_SOCKET:    return pkg_a != pkg_b;
+        case PLACE_NONE:
+        case PLACE_SAME_CORE:
+        case PLACE_COUNT:
+        default:                    return 0;
+    }
+}
+
+int ResolvePlacement(Placement place, CpuPair *cpus) {
+    assert(cpus);
+
+    cpus->parent = -1;
+    cpus->child  = -1;
+
+    if (place == PLACE_NONE) return 0;
+
+    int num_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+
+    for (int a = 0; a < num_cpus; a++) {
+        if (!CpuOnline(a)) continue;
+
+        if (place == PLACE_SAME_CORE) {
+            cpus->parent = cpus->child = a;
+            return 0;
+        }
+
+        int core_a = ReadTopologyId(a, "core_id");
+        int pkg_a  = ReadTopologyId(a, "physical_package_id");
+        if (core_a == -1 || pkg_a == -1) continue;
+
+        for (int b = a + 1; b < num_cpus; b++) {
+            if (!CpuOnline(b)) continue;
+
+            int core_b = ReadTopologyId(b, "core_id");
+            int pkg_b  = ReadTopologyId(b, "physical_package_id");
+            if (core_b == -1 || pkg_b == -1) continue;
+
+            if (Matches(place, core_a, pkg_a, core_b, pkg_b)) {
+                cpus->parent = a;
+                cpus->child  = b;
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/* pins the calling process, memory it touches afterwards is allocated on the local node */
+int PinToCpu(int cpu) {
+    if (cpu < 0) return 0;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET((size_t)cpu, &cpuset);
+
+    return sched_setaffinity(0, sizeof(cpuset), &cpuset);
+}
+
+const char* PlacementName(Placement place) {
+    switch (place) {
+        case PLACE_NONE:            return "none";
+        case PLACE_SAME_CORE:       return "same-core";
+        case PLACE_SMT_SIBLINGS:    return "smt-siblings";
+        case PLACE_SAME_SOCKET:     return "same-socket";
+        case PLACE_CROSS_SOCKET:    return "cross-socket";
+        case PLACE_COUNT:
+        default:                    return "unknown";
+    }
+}
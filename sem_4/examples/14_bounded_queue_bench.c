@@ -0,0 +1,182 @@
+/* Benchmark of the bounded queues of bounded_queue.h: every producer pushes its items stamped with
+   the time of the push, consumers pop them and record the latency (push -> pop). Printed per queue
+   and per number of producers and consumers: throughput and the latency percentiles.
+
+   The mutex and semaphore queues sleep when they cannot proceed, the lock-free ones spin and yield:
+   compare them both with fewer threads than cores and with more.
+
+   usage:
+       gcc -O2 -pthread 14_bounded_queue_bench.c -o bounded_queue_bench
+       ./bounded_queue_bench [items per producer] [max producers/consumers] [capacity]
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bounded_queue.h"
+
+#define DEFAULT_ITEMS 200000
+#define DEFAULT_MAX_THREADS 4
+#define DEFAULT_CAPACITY 1024
+#define MAX_THREADS 64
+
+struct consumer_arg {
+    struct bounded_queue* q;
+    uint64_t* latencies;        /* room for every item of the run */
+    size_t count;
+};
+
+struct producer_arg {
+    struct bounded_queue* q;
+    size_t items;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void* producer(void* arg) {
+    struct producer_arg* p = arg;
+
+    for (size_t i = 0; i < p->items; i++) {
+        /* the timestamp is the item; it is never 0, which is the stop sign */
+        bq_push(p->q, (void*)(uintptr_t)now_ns());
+    }
+    return NULL;
+}
+
+static void* consumer(void* arg) {
+    struct consumer_arg* c = arg;
+
+    for (;;) {
+        void* item = NULL;
+        bq_pop(c->q, &item);
+        if (item == NULL) {
+            break;
+        }
+        c->latencies[c->count++] = now_ns() - (uint64_t)(uintptr_t)item;
+    }
+    return NULL;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t* sorted, size_t n, double p) {
+    size_t i = (size_t)(p * (double)(n - 1));
+    return sorted[i];
+}
+
+/* 0 on success; the latencies of all consumers are gathered in all (room for every item) */
+static int run(enum bq_kind kind, int n_producers, int n_consumers, size_t items, size_t capacity,
+               uint64_t* all) {
+    struct bounded_queue q;
+    if (bq_init(&q, kind, capacity) != 0) {
+        fprintf(stderr, "failed to create the %s queue\n", bq_name(kind));
+        return -1;
+    }
+
+    size_t total = items * (size_t)n_producers;
+    pthread_t producers[MAX_THREADS], consumers[MAX_THREADS];
+    struct producer_arg pargs[MAX_THREADS];
+    struct consumer_arg cargs[MAX_THREADS];
+
+    for (int i = 0; i < n_consumers; i++) {
+        cargs[i] = (struct consumer_arg){ .q = &q, .latencies = malloc(total * sizeof(uint64_t)), .count = 0 };
+        if (cargs[i].latencies == NULL) {
+            fprintf(stderr, "failed to allocate latency samples\n");
+            exit(1);
+        }
+    }
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < n_consumers; i++) {
+        pthread_create(&consumers[i], NULL, consumer, &cargs[i]);
+    }
+    for (int i = 0; i < n_producers; i++) {
+        pargs[i] = (struct producer_arg){ .q = &q, .items = items };
+        pthread_create(&producers[i], NULL, producer, &pargs[i]);
+    }
+
+    for (int i = 0; i < n_producers; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    /* one stop sign per consumer, they come after all the items (FIFO) */
+    for (int i = 0; i < n_consumers; i++) {
+        bq_push(&q, NULL);
+    }
+    for (int i = 0; i < n_consumers; i++) {
+        pthread_join(consumers[i], NULL);
+    }
+
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    size_t n = 0;
+    for (int i = 0; i < n_consumers; i++) {
+        for (size_t k = 0; k < cargs[i].count; k++) {
+            all[n++] = cargs[i].latencies[k];
+        }
+        free(cargs[i].latencies);
+    }
+    bq_destroy(&q);
+
+    if (n != total) {
+        fprintf(stderr, "%s: %zu items of %zu came out\n", bq_name(kind), n, total);
+        return -1;
+    }
+
+    qsort(all, n, sizeof(*all), compare_u64);
+    printf("%-10s %3d %3d %10.3f %10llu %10llu %10llu %12llu\n", bq_name(kind), n_producers, n_consumers,
+           (double)n / seconds / 1e6,
+           (unsigned long long)percentile(all, n, 0.5), (unsigned long long)percentile(all, n, 0.99),
+           (unsigned long long)percentile(all, n, 0.999), (unsigned long long)all[n - 1]);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    size_t items = (argc > 1) ? strtoull(argv[1], NULL, 0) : DEFAULT_ITEMS;
+    int max_threads = (argc > 2) ? atoi(argv[2]) : DEFAULT_MAX_THREADS;
+    size_t capacity = (argc > 3) ? strtoull(argv[3], NULL, 0) : DEFAULT_CAPACITY;
+
+    if (items == 0 || max_threads < 1 || max_threads > MAX_THREADS || capacity == 0) {
+        fprintf(stderr, "usage: %s [items per producer] [max producers/consumers <= %d] [capacity]\n",
+                argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    uint64_t* all = malloc(items * (size_t)max_threads * sizeof(uint64_t));
+    if (all == NULL) {
+        fprintf(stderr, "failed to allocate latency samples\n");
+        return 1;
+    }
+
+    printf("%zu items per producer, capacity %zu, latency in ns\n", items, capacity);
+    printf("%-10s %3s %3s %10s %10s %10s %10s %12s\n", "queue", "P", "C", "Mops/s", "p50", "p99", "p99.9", "max");
+
+    for (int kind = 0; kind < BQ_NUM_KINDS; kind++) {
+        for (int p = 1; p <= max_threads; p++) {
+            for (int c = 1; c <= max_threads; c++) {
+                /* the SPSC ring is only correct with one thread at each end */
+                if (kind == BQ_SPSC && (p > 1 || c > 1)) {
+                    continue;
+                }
+                if (run((enum bq_kind)kind, p, c, items, capacity, all) != 0) {
+                    free(all);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    free(all);
+    return 0;
+}
@@ -0,0 +1,175 @@
+/* Contention benchmark of the locks of locks.h against pthread_mutex and pthread_spinlock.
+   Every thread repeats: take the lock, do cs units of work on shared data, release, do 100 units
+   of private work. Each run lasts a fixed time; printed are the lock acquisitions per second and
+   the fairness, the fewest acquisitions of a thread divided by the most.
+
+   Expected picture: with short critical sections and no more threads than cores the spinning
+   locks win, the mutex pays for the system calls; with long sections or more threads than cores
+   spinning burns the time slices the owner needs, the mutex and the spin-then-park lock win.
+
+   usage:
+       gcc -O2 -pthread 15_lock_contention_bench.c -o lock_contention_bench
+       ./lock_contention_bench [max threads] [milliseconds per run]
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "locks.h"
+
+#define MAX_THREADS 64
+#define OUTSIDE_WORK 100
+
+enum lock_kind { LOCK_MUTEX, LOCK_SPINLOCK, LOCK_SPIN_PARK, LOCK_TICKET, LOCK_MCS, NUM_LOCKS };
+
+static const char* const LOCK_NAMES[NUM_LOCKS] = { "mutex", "spinlock", "spin_park", "ticket", "mcs" };
+static const unsigned CS_LENGTHS[] = { 0, 20, 200, 2000 };
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_spinlock_t spinlock;
+static struct spin_park_lock spin_park;
+static struct ticket_lock ticket;
+static struct mcs_lock mcs;
+
+static enum lock_kind current_lock;
+static unsigned cs_length;
+static _Atomic int stop;
+static uint64_t shared_state;       /* protected by the lock under test */
+static uint64_t cs_entries;         /* the same, must end up equal to the sum of ops */
+
+struct worker {
+    _Alignas(LOCK_CACHE_LINE) uint64_t ops;
+    struct mcs_node node;
+};
+
+static struct worker workers[MAX_THREADS];
+
+/* a chain of dependent multiplications the compiler cannot drop */
+static inline uint64_t work(uint64_t x, unsigned units) {
+    for (unsigned i = 0; i < units; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        __asm__ __volatile__("" : "+r"(x));
+    }
+    return x;
+}
+
+static inline void critical_section(void) {
+    shared_state = work(shared_state, cs_length);
+    cs_entries++;
+}
+
+static void* worker_main(void* arg) {
+    struct worker* w = arg;
+    uint64_t x = (uint64_t)(uintptr_t)arg;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        switch (current_lock) {
+        case LOCK_MUTEX:
+            pthread_mutex_lock(&mutex);
+            critical_section();
+            pthread_mutex_unlock(&mutex);
+            break;
+        case LOCK_SPINLOCK:
+            pthread_spin_lock(&spinlock);
+            critical_section();
+            pthread_spin_unlock(&spinlock);
+            break;
+        case LOCK_SPIN_PARK:
+            spin_park_lock(&spin_park);
+            critical_section();
+            spin_park_unlock(&spin_park);
+            break;
+        case LOCK_TICKET:
+            ticket_lock(&ticket);
+            critical_section();
+            ticket_unlock(&ticket);
+            break;
+        case LOCK_MCS:
+            mcs_lock(&mcs, &w->node);
+            critical_section();
+            mcs_unlock(&mcs, &w->node);
+            break;
+        default:
+            return NULL;
+        }
+        w->ops++;
+        x = work(x, OUTSIDE_WORK);
+    }
+
+    __asm__ __volatile__("" : : "r"(x));
+    return NULL;
+}
+
+static void run(enum lock_kind kind, int n_threads, unsigned cs, int ms) {
+    pthread_t threads[MAX_THREADS];
+
+    current_lock = kind;
+    cs_length = cs;
+    cs_entries = 0;
+    atomic_store(&stop, 0);
+    for (int i = 0; i < n_threads; i++) {
+        workers[i].ops = 0;
+    }
+
+    for (int i = 0; i < n_threads; i++) {
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+
+    struct timespec duration = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+    nanosleep(&duration, NULL);
+    atomic_store(&stop, 1);
+
+    for (int i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    uint64_t total = 0, min_ops = UINT64_MAX, max_ops = 0;
+    for (int i = 0; i < n_threads; i++) {
+        total += workers[i].ops;
+        min_ops = (workers[i].ops < min_ops) ? workers[i].ops : min_ops;
+        max_ops = (workers[i].ops > max_ops) ? workers[i].ops : max_ops;
+    }
+
+    if (cs_entries != total) {
+        fprintf(stderr, "%s: %llu critical sections for %llu acquisitions, the lock is broken\n",
+                LOCK_NAMES[kind], (unsigned long long)cs_entries, (unsigned long long)total);
+    }
+
+    printf("%-10s %7d %6u %10.3f %8.3f\n", LOCK_NAMES[kind], n_threads, cs,
+           (double)total / (ms / 1000.0) / 1e6, (max_ops > 0) ? (double)min_ops / (double)max_ops : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    int n_cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (argc > 1) ? atoi(argv[1]) : 2 * n_cores;
+    int ms = (argc > 2) ? atoi(argv[2]) : 200;
+
+    if (max_threads < 1 || max_threads > MAX_THREADS || ms < 1) {
+        fprintf(stderr, "usage: %s [max threads <= %d] [milliseconds per run]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    pthread_spin_init(&spinlock, PTHREAD_PROCESS_PRIVATE);
+    spin_park_init(&spin_park);
+    ticket_init(&ticket);
+    mcs_init(&mcs);
+
+    printf("%d cores, %d ms per run, critical section in units of work\n", n_cores, ms);
+    printf("%-10s %7s %6s %10s %8s\n", "lock", "threads", "cs", "Mops/s", "fairness");
+
+    for (size_t c = 0; c < sizeof(CS_LENGTHS) / sizeof(CS_LENGTHS[0]); c++) {
+        for (int t = 1; t <= max_threads; t *= 2) {
+            for (int kind = 0; kind < NUM_LOCKS; kind++) {
+                run((enum lock_kind)kind, t, CS_LENGTHS[c], ms);
+            }
+        }
+    }
+
+    pthread_spin_destroy(&spinlock);
+    return 0;
+}
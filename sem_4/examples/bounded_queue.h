@@ -0,0 +1,391 @@
+/* Header-only bounded queue of pointers with four interchangeable implementations:
+
+   BQ_MUTEX  - ring buffer under one mutex, producers and consumers sleep on two condition variables
+               (the same scheme as producer-cons.c);
+   BQ_SEM    - ring buffer with two POSIX counting semaphores for the free and the filled slots
+               (sem_posix.c, 6_posix_cnt_sem.c) and a mutex per end for the indices;
+   BQ_SPSC   - lock-free ring for exactly one producer and one consumer: each side owns one index
+               and only reads the other, no atomic read-modify-write at all;
+   BQ_MPMC   - lock-free ring for any number of producers and consumers (D. Vyukov's bounded queue):
+               every cell carries a sequence number telling whose turn it is, an index is claimed by CAS.
+
+   bq_push() and bq_pop() block: the first two sleep in the kernel, the lock-free ones spin with
+   "pause" and then yield the CPU (sched_yield), which matters once there are more threads than cores.
+   bq_try_push() and bq_try_pop() return 0 at once if the queue is full (empty).
+
+   usage:
+       #include "bounded_queue.h"
+       struct bounded_queue q;
+       bq_init(&q, BQ_MPMC, 1024);         // capacity is rounded up to a power of two
+       bq_push(&q, item);  bq_pop(&q, &item);
+       bq_destroy(&q);
+   compile the programs that use it with -pthread (C11 atomics).
+*/
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#define BQ_CACHE_LINE 64
+#define BQ_SPINS_BEFORE_YIELD 64
+
+enum bq_kind {
+    BQ_MUTEX,
+    BQ_SEM,
+    BQ_SPSC,
+    BQ_MPMC,
+    BQ_NUM_KINDS,
+};
+
+struct bq_cell {
+    _Atomic size_t seq;         /* MPMC: == pos - free for the producer of pos, == pos + 1 - filled */
+    void* item;
+};
+
+struct bounded_queue {
+    enum bq_kind kind;
+    size_t capacity;            /* power of two */
+    size_t mask;
+    struct bq_cell* cells;
+
+    /* BQ_MUTEX, BQ_SEM */
+    pthread_mutex_t lock;       /* BQ_MUTEX: the whole queue, BQ_SEM: the producer end */
+    pthread_mutex_t pop_lock;   /* BQ_SEM: the consumer end */
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+    sem_t free_slots;
+    sem_t filled_slots;
+    size_t count;
+
+    /* the two ends on their own cache lines, so producers and consumers do not bounce one line */
+    _Alignas(BQ_CACHE_LINE) _Atomic size_t head;   /* next slot to pop */
+    size_t cached_tail;                            /* SPSC: consumer's copy of tail */
+    _Alignas(BQ_CACHE_LINE) _Atomic size_t tail;   /* next slot to push */
+    size_t cached_head;                            /* SPSC: producer's copy of head */
+};
+
+static const char* const BQ_NAMES[BQ_NUM_KINDS] = { "mutex", "semaphore", "spsc", "mpmc" };
+
+static inline const char* bq_name(enum bq_kind kind) {
+    return (kind >= 0 && kind < BQ_NUM_KINDS) ? BQ_NAMES[kind] : "unknown";
+}
+
+static inline void bq_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* spin a little, then let the other side run: with one core it cannot make progress while we spin */
+static inline void bq_backoff(unsigned* spins) {
+    if (++*spins < BQ_SPINS_BEFORE_YIELD) {
+        bq_cpu_relax();
+    } else {
+        sched_yield();
+    }
+}
+
+/* 0 on success, -1 if the memory or a primitive could not be allocated */
+static inline int bq_init(struct bounded_queue* q, enum bq_kind kind, size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) {
+        cap *= 2;
+    }
+
+    q->kind = kind;
+    q->capacity = cap;
+    q->mask = cap - 1;
+    q->count = 0;
+    q->cached_head = 0;
+    q->cached_tail = 0;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+
+    /* aligned_alloc wants the size to be a multiple of the alignment */
+    size_t bytes = (cap * sizeof(*q->cells) + BQ_CACHE_LINE - 1) / BQ_CACHE_LINE * BQ_CACHE_LINE;
+    q->cells = aligned_alloc(BQ_CACHE_LINE, bytes);
+    if (q->cells == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < cap; i++) {
+        atomic_init(&q->cells[i].seq, i);
+        q->cells[i].item = NULL;
+    }
+
+    switch (kind) {
+    case BQ_MUTEX:
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->not_full, NULL);
+        pthread_cond_init(&q->not_empty, NULL);
+        return 0;
+    case BQ_SEM:
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_mutex_init(&q->pop_lock, NULL);
+        if (sem_init(&q->free_slots, 0, (unsigned)cap) != 0 || sem_init(&q->filled_slots, 0, 0) != 0) {
+            free(q->cells);
+            return -1;
+        }
+        return 0;
+    case BQ_SPSC:
+    case BQ_MPMC:
+        return 0;
+    default:
+        free(q->cells);
+        return -1;
+    }
+}
+
+static inline void bq_destroy(struct bounded_queue* q) {
+    switch (q->kind) {
+    case BQ_MUTEX:
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->not_full);
+        pthread_cond_destroy(&q->not_empty);
+        break;
+    case BQ_SEM:
+        pthread_mutex_destroy(&q->lock);
+        pthread_mutex_destroy(&q->pop_lock);
+        sem_destroy(&q->free_slots);
+        sem_destroy(&q->filled_slots);
+        break;
+    default:
+        break;
+    }
+    free(q->cells);
+    q->cells = NULL;
+}
+
+/* ---------------------------------------------------------------- lock-free SPSC */
+
+static inline int bq_spsc_try_push(struct bounded_queue* q, void* item) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    /* re-read the consumer's index only when the cached one says "full" */
+    if (tail - q->cached_head == q->capacity) {
+        q->cached_head = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail - q->cached_head == q->capacity) {
+            return 0;
+        }
+    }
+
+    q->cells[tail & q->mask].item = item;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);   /* publishes the item */
+    return 1;
+}
+
+static inline int bq_spsc_try_pop(struct bounded_queue* q, void** item) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (head == q->cached_tail) {
+        q->cached_tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head == q->cached_tail) {
+            return 0;
+        }
+    }
+
+    *item = q->cells[head & q->mask].item;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);   /* gives the slot back */
+    return 1;
+}
+
+/* ---------------------------------------------------------------- lock-free MPMC (Vyukov) */
+
+static inline int bq_mpmc_try_push(struct bounded_queue* q, void* item) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    for (;;) {
+        struct bq_cell* cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+
+        if (diff == 0) {
+            /* the cell is free for this lap: claim the position */
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->item = item;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;           /* the consumer of the previous lap has not taken it yet: full */
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
+
+static inline int bq_mpmc_try_pop(struct bounded_queue* q, void** item) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    for (;;) {
+        struct bq_cell* cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *item = cell->item;
+                /* free for the producer of the next lap */
+                atomic_store_explicit(&cell->seq, pos + q->capacity, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;           /* not filled yet: empty */
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
+
+/* ---------------------------------------------------------------- ring under locks */
+
+static inline void bq_ring_put(struct bounded_queue* q, void* item) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    q->cells[tail & q->mask].item = item;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_relaxed);
+}
+
+static inline void* bq_ring_take(struct bounded_queue* q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    void* item = q->cells[head & q->mask].item;
+    atomic_store_explicit(&q->head, head + 1, memory_order_relaxed);
+    return item;
+}
+
+/* ---------------------------------------------------------------- common interface */
+
+static inline int bq_try_push(struct bounded_queue* q, void* item) {
+    switch (q->kind) {
+    case BQ_MUTEX: {
+        int ok = 0;
+        pthread_mutex_lock(&q->lock);
+        if (q->count < q->capacity) {
+            bq_ring_put(q, item);
+            q->count++;
+            ok = 1;
+            pthread_cond_signal(&q->not_empty);
+        }
+        pthread_mutex_unlock(&q->lock);
+        return ok;
+    }
+    case BQ_SEM:
+        if (sem_trywait(&q->free_slots) != 0) {
+            return 0;
+        }
+        pthread_mutex_lock(&q->lock);
+        bq_ring_put(q, item);
+        pthread_mutex_unlock(&q->lock);
+        sem_post(&q->filled_slots);
+        return 1;
+    case BQ_SPSC:
+        return bq_spsc_try_push(q, item);
+    case BQ_MPMC:
+        return bq_mpmc_try_push(q, item);
+    default:
+        return 0;
+    }
+}
+
+static inline int bq_try_pop(struct bounded_queue* q, void** item) {
+    switch (q->kind) {
+    case BQ_MUTEX: {
+        int ok = 0;
+        pthread_mutex_lock(&q->lock);
+        if (q->count > 0) {
+            *item = bq_ring_take(q);
+            q->count--;
+            ok = 1;
+            pthread_cond_signal(&q->not_full);
+        }
+        pthread_mutex_unlock(&q->lock);
+        return ok;
+    }
+    case BQ_SEM:
+        if (sem_trywait(&q->filled_slots) != 0) {
+            return 0;
+        }
+        pthread_mutex_lock(&q->pop_lock);
+        *item = bq_ring_take(q);
+        pthread_mutex_unlock(&q->pop_lock);
+        sem_post(&q->free_slots);
+        return 1;
+    case BQ_SPSC:
+        return bq_spsc_try_pop(q, item);
+    case BQ_MPMC:
+        return bq_mpmc_try_pop(q, item);
+    default:
+        return 0;
+    }
+}
+
+static inline void bq_push(struct bounded_queue* q, void* item) {
+    unsigned spins = 0;
+
+    switch (q->kind) {
+    case BQ_MUTEX:
+        pthread_mutex_lock(&q->lock);
+        while (q->count == q->capacity) {
+            pthread_cond_wait(&q->not_full, &q->lock);
+        }
+        bq_ring_put(q, item);
+        q->count++;
+        pthread_cond_signal(&q->not_empty);
+        pthread_mutex_unlock(&q->lock);
+        break;
+    case BQ_SEM:
+        while (sem_wait(&q->free_slots) != 0) {
+            ;   /* EINTR */
+        }
+        pthread_mutex_lock(&q->lock);
+        bq_ring_put(q, item);
+        pthread_mutex_unlock(&q->lock);
+        sem_post(&q->filled_slots);
+        break;
+    default:
+        while (!bq_try_push(q, item)) {
+            bq_backoff(&spins);
+        }
+        break;
+    }
+}
+
+static inline void bq_pop(struct bounded_queue* q, void** item) {
+    unsigned spins = 0;
+
+    switch (q->kind) {
+    case BQ_MUTEX:
+        pthread_mutex_lock(&q->lock);
+        while (q->count == 0) {
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        }
+        *item = bq_ring_take(q);
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+        pthread_mutex_unlock(&q->lock);
+        break;
+    case BQ_SEM:
+        while (sem_wait(&q->filled_slots) != 0) {
+            ;   /* EINTR */
+        }
+        pthread_mutex_lock(&q->pop_lock);
+        *item = bq_ring_take(q);
+        pthread_mutex_unlock(&q->pop_lock);
+        sem_post(&q->free_slots);
+        break;
+    default:
+        while (!bq_try_pop(q, item)) {
+            bq_backoff(&spins);
+        }
+        break;
+    }
+}
+
+#endif /* BOUNDED_QUEUE_H */
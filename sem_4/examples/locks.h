@@ -0,0 +1,195 @@
+/* Header-only locks to compare with pthread_mutex and pthread_spinlock (10_mutex_vs_spinlock.c):
+
+   spin_park - spins with "pause" for a bounded number of iterations, then sleeps on a futex.
+               The bound adapts like glibc's PTHREAD_MUTEX_ADAPTIVE_NP: a running average of the
+               spins that were enough to get the lock, so short critical sections are waited out
+               on the CPU and long ones cost one system call instead of a burned time slice;
+   ticket    - FIFO spinlock: take a number, wait until it is served. Fair, but every waiter spins
+               on the same cache line and a preempted waiter stalls everyone behind it;
+   mcs       - queue lock (Mellor-Crummey and Scott): every waiter spins on a flag in its own node,
+               the owner hands the lock to the next node, so one cache line moves per handoff.
+
+   Linux only (futex). Compile with -pthread.
+*/
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOCK_CACHE_LINE 64
+#define SPIN_PARK_MAX_SPINS 1000            /* upper bound of the adaptive spin */
+#define SPINS_BEFORE_YIELD 1024             /* ticket/mcs: give the CPU away when oversubscribed */
+
+static inline void lock_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* a pure spinlock cannot progress while the owner is not running: yield now and then */
+static inline void lock_spin_wait(unsigned* spins) {
+    if (++*spins % SPINS_BEFORE_YIELD == 0) {
+        sched_yield();
+    } else {
+        lock_cpu_relax();
+    }
+}
+
+/* ---------------------------------------------------------------- spin-then-park (futex) */
+
+struct spin_park_lock {
+    _Atomic int state;          /* 0 - free, 1 - locked, 2 - locked and someone may sleep */
+    _Atomic int spin_limit;     /* adaptive estimate of the useful spin */
+};
+
+#define SPIN_PARK_LOCK_INITIALIZER { 0, 100 }
+
+static inline void spin_park_init(struct spin_park_lock* l) {
+    atomic_init(&l->state, 0);
+    atomic_init(&l->spin_limit, 100);
+}
+
+static inline long futex_wait(_Atomic int* addr, int expected) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static inline long futex_wake(_Atomic int* addr, int n) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static inline void spin_park_lock(struct spin_park_lock* l) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong_explicit(&l->state, &expected, 1,
+                                                memory_order_acquire, memory_order_relaxed)) {
+        return;
+    }
+
+    /* spin a little longer than what was usually enough, read-only until the lock looks free */
+    int limit = atomic_load_explicit(&l->spin_limit, memory_order_relaxed);
+    int max_spins = (2 * limit + 10 < SPIN_PARK_MAX_SPINS) ? 2 * limit + 10 : SPIN_PARK_MAX_SPINS;
+
+    for (int spins = 0; spins < max_spins; spins++) {
+        if (atomic_load_explicit(&l->state, memory_order_relaxed) == 0) {
+            expected = 0;
+            if (atomic_compare_exchange_weak_explicit(&l->state, &expected, 1,
+                                                      memory_order_acquire, memory_order_relaxed)) {
+                atomic_store_explicit(&l->spin_limit, limit + (spins - limit) / 8, memory_order_relaxed);
+                return;
+            }
+        }
+        lock_cpu_relax();
+    }
+
+    /* the spin did not pay off: pull the estimate up, then sleep (Drepper, "Futexes are tricky") */
+    atomic_store_explicit(&l->spin_limit, limit + (max_spins - limit) / 8, memory_order_relaxed);
+
+    int state = atomic_exchange_explicit(&l->state, 2, memory_order_acquire);
+    while (state != 0) {
+        futex_wait(&l->state, 2);
+        state = atomic_exchange_explicit(&l->state, 2, memory_order_acquire);
+    }
+}
+
+static inline void spin_park_unlock(struct spin_park_lock* l) {
+    /* 1 -> 0 needs no system call; 2 means there may be sleepers */
+    if (atomic_exchange_explicit(&l->state, 0, memory_order_release) == 2) {
+        futex_wake(&l->state, 1);
+    }
+}
+
+/* ---------------------------------------------------------------- ticket */
+
+struct ticket_lock {
+    _Atomic unsigned next;
+    _Atomic unsigned serving;
+};
+
+static inline void ticket_init(struct ticket_lock* l) {
+    atomic_init(&l->next, 0);
+    atomic_init(&l->serving, 0);
+}
+
+static inline void ticket_lock(struct ticket_lock* l) {
+    unsigned my = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+    unsigned spins = 0;
+
+    for (;;) {
+        unsigned serving = atomic_load_explicit(&l->serving, memory_order_acquire);
+        if (serving == my) {
+            return;
+        }
+        /* proportional backoff: the further in the line, the less often we look */
+        for (unsigned i = 0; i < (my - serving) * 16; i++) {
+            lock_cpu_relax();
+        }
+        lock_spin_wait(&spins);
+    }
+}
+
+static inline void ticket_unlock(struct ticket_lock* l) {
+    unsigned serving = atomic_load_explicit(&l->serving, memory_order_relaxed);
+    atomic_store_explicit(&l->serving, serving + 1, memory_order_release);
+}
+
+/* ---------------------------------------------------------------- MCS queue lock */
+
+struct mcs_node {
+    _Alignas(LOCK_CACHE_LINE) struct mcs_node* _Atomic next;
+    _Atomic int locked;         /* 1 while this waiter has to wait */
+};
+
+struct mcs_lock {
+    struct mcs_node* _Atomic tail;
+};
+
+static inline void mcs_init(struct mcs_lock* l) {
+    atomic_init(&l->tail, NULL);
+}
+
+/* node belongs to the caller (on its stack or per thread) until mcs_unlock() returns */
+static inline void mcs_lock(struct mcs_lock* l, struct mcs_node* node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+
+    struct mcs_node* prev = atomic_exchange_explicit(&l->tail, node, memory_order_acq_rel);
+    if (prev == NULL) {
+        return;
+    }
+
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+
+    unsigned spins = 0;
+    while (atomic_load_explicit(&node->locked, memory_order_acquire)) {
+        lock_spin_wait(&spins);
+    }
+}
+
+static inline void mcs_unlock(struct mcs_lock* l, struct mcs_node* node) {
+    struct mcs_node* next = atomic_load_explicit(&node->next, memory_order_acquire);
+
+    if (next == NULL) {
+        /* nobody behind us: release, unless someone is just linking in */
+        struct mcs_node* expected = node;
+        if (atomic_compare_exchange_strong_explicit(&l->tail, &expected, NULL,
+                                                    memory_order_release, memory_order_relaxed)) {
+            return;
+        }
+
+        unsigned spins = 0;
+        while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL) {
+            lock_spin_wait(&spins);
+        }
+    }
+
+    atomic_store_explicit(&next->locked, 0, memory_order_release);
+}
+
+#endif /* LOCKS_H */
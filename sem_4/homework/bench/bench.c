@@ -0,0 +1,511 @@
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <math.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "monte_carlo.h"
+
+/*
+    Non-interactive scaling benchmark: every (placement, threads) pair is
+    integrated -r times, the counters of every worker are written as CSV.
+
+    -o <file>               CSV output (default: stdout)
+    -t <n,n,...>            thread counts (default: 1,2,4,8)
+    -P <policy,...>         placements (default: linear)
+    -k <backend,...>        threads, processes (default: threads); processes have no counters
+    -r <reps>               repetitions of every configuration (default: 3)
+    -N <points>             point budget (default: 10M)
+    -g <cells>              root of the number of grid cells (default: 4)
+    -f <name>               integrand: exp, poly, sin (default: exp)
+    -s <seed>               master seed (default: 1)
+    -b <integrals>          instead of the sweep: that many short integrals with a pool per call,
+                            with one shared pool and as one CalculateIntegrals() submission
+    -G <draws>              instead of the sweep: uniform draws per second of rand_r(), xoshiro256**
+                            and philox with every refill the CPU has, in one thread
+*/
+
+#define MAX_LIST 64
+
+enum Counter {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT,
+};
+
+static const uint64_t COUNTER_CONFIGS[COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/* one per worker, opened and read by the worker thread itself */
+struct WorkerCounters {
+    _Alignas(CACHE_LINE) int fds[COUNTER_COUNT];
+    int64_t             values[COUNTER_COUNT];  // -1 - the counter is unavailable
+};
+
+struct BenchOptions {
+    const char          *output;
+    int                 threads[MAX_LIST];
+    int                 n_threads;
+    enum PlacementPolicy policies[MAX_LIST];
+    int                 n_policies;
+    enum Backend        backends[MAX_LIST];
+    int                 n_backends;
+    int                 reps;
+    int                 cells_sqrt;
+    const char          *integrand;
+    size_t              batch;
+    size_t              draws;
+    struct IntegralConfig config;
+};
+
+static long PerfEventOpen(struct perf_event_attr *attr) {
+    /* this thread, any CPU it runs on */
+    return syscall(SYS_perf_event_open, attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* user space only: perf_event_paranoid up to 2 allows it without privileges */
+static void OpenCounters(int worker, void *arg) {
+    struct WorkerCounters *counters = &((struct WorkerCounters*)arg)[worker];
+
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        struct perf_event_attr attr = {
+            .type           = PERF_TYPE_HARDWARE,
+            .size           = sizeof(attr),
+            .config         = COUNTER_CONFIGS[c],
+            .exclude_kernel = 1,
+            .exclude_hv     = 1,
+        };
+
+        counters->fds[c]    = (int)PerfEventOpen(&attr);
+        counters->values[c] = -1;
+    }
+}
+
+static void ReadCounters(int worker, void *arg) {
+    struct WorkerCounters *counters = &((struct WorkerCounters*)arg)[worker];
+
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (counters->fds[c] < 0) continue;
+
+        uint64_t value = 0;
+        if (read(counters->fds[c], &value, sizeof(value)) == (ssize_t)sizeof(value)) {
+            counters->values[c] = (int64_t)value;
+        }
+
+        close(counters->fds[c]);
+        counters->fds[c] = -1;
+    }
+}
+
+/* "1,2,4" -> {1, 2, 4}, returns the count or -1 */
+static int ParseIntList(const char *list, int *values) {
+    int count = 0;
+    for (const char *p = list; *p != '\0' && count < MAX_LIST; count++) {
+        char *end = NULL;
+        long value = strtol(p, &end, 10);
+        if (end == p || value <= 0 || (*end != ',' && *end != '\0')) return -1;
+
+        values[count] = (int)value;
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    return count;
+}
+
+static int ParsePolicyList(const char *list, enum PlacementPolicy *policies) {
+    char buffer[256] = {};
+    strncpy(buffer, list, sizeof(buffer) - 1);
+
+    int count = 0;
+    for (char *save = NULL, *name = strtok_r(buffer, ",", &save); name != NULL && count < MAX_LIST;
+         name = strtok_r(NULL, ",", &save)) {
+        if (ParsePlacement(name, &policies[count]) == -1) {
+            fprintf(stderr, "unknown placement '%s'\n", name);
+            return -1;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+static int ParseBackendList(const char *list, enum Backend *backends) {
+    char buffer[256] = {};
+    strncpy(buffer, list, sizeof(buffer) - 1);
+
+    int count = 0;
+    for (char *save = NULL, *name = strtok_r(buffer, ",", &save); name != NULL && count < MAX_LIST;
+         name = strtok_r(NULL, ",", &save)) {
+        if (ParseBackend(name, &backends[count]) == -1) {
+            fprintf(stderr, "unknown backend '%s'\n", name);
+            return -1;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+static int ParseArgs(int argc, char *argv[], struct BenchOptions *options) {
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "o:t:P:k:r:N:g:f:s:b:G:")) != -1) {
+        switch (opt) {
+            case 'o':
+                options->output = optarg;
+                break;
+            case 't':
+                options->n_threads = ParseIntList(optarg, options->threads);
+                if (options->n_threads <= 0) {
+                    fprintf(stderr, "bad thread list '%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'P':
+                options->n_policies = ParsePolicyList(optarg, options->policies);
+                if (options->n_policies <= 0) return -1;
+                break;
+            case 'k':
+                options->n_backends = ParseBackendList(optarg, options->backends);
+                if (options->n_backends <= 0) return -1;
+                break;
+            case 'r':
+                options->reps = atoi(optarg);
+                break;
+            case 'N':
+                options->config.max_points = strtoull(optarg, NULL, 0);
+                break;
+            case 'g':
+                options->cells_sqrt = atoi(optarg);
+                break;
+            case 'f':
+                options->integrand = optarg;
+                break;
+            case 's':
+                options->config.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'b':
+                options->batch = strtoull(optarg, NULL, 0);
+                break;
+            case 'G':
+                options->draws = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-o csv] [-t n,n,...] [-P policy,...] [-k backend,...] [-r reps] [-N points] [-g cells] [-f integrand] [-s seed] [-b integrals] [-G draws]\n",
+                        argv[0]);
+                return -1;
+        }
+    }
+
+    if (options->reps <= 0 || options->cells_sqrt <= 0) {
+        fprintf(stderr, "repetitions and grid size must be positive\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void WriteRow(FILE *out, enum Backend backend, enum PlacementPolicy policy, int threads, int rep,
+                     const struct IntegralResult *result, const char *worker, const int64_t *values) {
+    fprintf(out, "%s,%s,%d,%d,%.6lf,%zu,%s", BackendName(backend), PlacementName(policy), threads, rep,
+            result->seconds, result->points, worker);
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        fprintf(out, ",%" PRId64, values[c]);
+    }
+    fprintf(out, "\n");
+}
+
+/* one integration, a row per worker and their sum as worker "all" */
+static int RunOnce(FILE *out, const struct BenchOptions *options, const struct Integrand *integrand,
+                   enum Backend backend, enum PlacementPolicy policy, int threads, int rep) {
+    struct WorkerCounters *counters = aligned_alloc(CACHE_LINE, (size_t)threads * sizeof(*counters));
+    if (counters == NULL) {
+        fprintf(stderr, "failed to allocate memory for counters\n");
+        return -1;
+    }
+
+    for (int w = 0; w < threads; w++) {
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            counters[w].fds[c]    = -1;
+            counters[w].values[c] = -1;
+        }
+    }
+
+    struct PoolHooks hooks = {
+        .start  = OpenCounters,
+        .stop   = ReadCounters,
+        .arg    = counters,
+    };
+
+    struct IntegralConfig config = options->config;
+    config.num_threads  = threads;
+    config.backend      = backend;
+    config.placement    = policy;
+    config.worker_hooks = &hooks;     // threads only, forked workers could not report back
+
+    struct IntegralResult result = CalculateIntegral(integrand, options->cells_sqrt,
+                                                     integrand->x_min, integrand->x_max, 0.0, integrand->y_max,
+                                                     &config);
+    if (result.points == 0) {
+        fprintf(stderr, "failed to run integration\n");
+        free(counters);
+        return -1;
+    }
+
+    int64_t total[COUNTER_COUNT] = {};
+    for (int w = 0; w < threads; w++) {
+        char worker[16] = {};
+        snprintf(worker, sizeof(worker), "%d", w);
+        WriteRow(out, backend, policy, threads, rep, &result, worker, counters[w].values);
+
+        /* the sum is unknown as soon as one worker could not count */
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            total[c] = (total[c] < 0 || counters[w].values[c] < 0) ? -1 : total[c] + counters[w].values[c];
+        }
+    }
+
+    WriteRow(out, backend, policy, threads, rep, &result, "all", total);
+
+    static int warned = 0;
+    if (backend == BACKEND_THREADS && total[COUNTER_CYCLES] < 0 && !warned) {
+        fprintf(stderr, "hardware counters are unavailable (no PMU or kernel.perf_event_paranoid > 2), written as -1\n");
+        warned = 1;
+    }
+    fflush(out);
+
+    fprintf(stderr, "%-9s %-9s %3d workers, rep %d: %.4lf s, %.1lf Mpoints/s\n", BackendName(backend),
+            PlacementName(policy), threads, rep, result.seconds, (double)result.points / result.seconds / 1e6);
+
+    FreeIntegralResult(&result);
+    free(counters);
+
+    return 0;
+}
+
+enum BatchMode {
+    BATCH_PER_CALL,             // CalculateIntegral() creates and joins its workers every time
+    BATCH_SHARED_POOL,          // CalculateIntegral() on one pool
+    BATCH_SUBMISSION,           // CalculateIntegrals()
+    BATCH_MODE_COUNT,
+};
+
+static const char *BATCH_MODE_NAMES[BATCH_MODE_COUNT] = {"per-call", "shared", "batch"};
+
+/*
+    options->batch integrals over growing prefixes of the default interval, every mode
+    in turn; max_diff is the largest distance to the per-call values, which must be 0
+*/
+static int RunBatches(FILE *out, const struct BenchOptions *options, const struct Integrand *integrand,
+                      int threads, int rep) {
+    size_t                  n        = options->batch;
+    struct IntegralRequest *requests = calloc(n, sizeof(*requests));
+    struct IntegralResult  *results  = calloc(n, sizeof(*results));
+    double                 *expected = calloc(n, sizeof(*expected));
+    if (requests == NULL || results == NULL || expected == NULL) {
+        fprintf(stderr, "failed to allocate memory for batch\n");
+        free(requests);
+        free(results);
+        free(expected);
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        requests[i] = (struct IntegralRequest){
+            .integrand      = integrand,
+            .num_cells_sqrt = options->cells_sqrt,
+            .x_min          = integrand->x_min,
+            .x_max          = integrand->x_min + (integrand->x_max - integrand->x_min) * (double)(i + 1) / (double)n,
+            .y_min          = 0.0,
+            .y_max          = integrand->y_max,
+        };
+    }
+
+    struct IntegralConfig config = options->config;
+    config.num_threads = threads;
+    config.placement   = options->policies[0];
+
+    int ret = 0;
+    for (int mode = 0; mode < BATCH_MODE_COUNT && ret == 0; mode++) {
+        uint64_t start = GetTimeNs();
+
+        config.pool = (mode == BATCH_SHARED_POOL) ? CreateThreadPool(threads, config.placement, NULL) : NULL;
+        if (mode == BATCH_SHARED_POOL && config.pool == NULL) {
+            ret = -1;
+            break;
+        }
+
+        if (mode == BATCH_SUBMISSION) {
+            ret = CalculateIntegrals(requests, n, results, &config);
+        } else {
+            for (size_t i = 0; i < n && ret == 0; i++) {
+                const struct IntegralRequest *request = &requests[i];
+
+                results[i] = CalculateIntegral(integrand, request->num_cells_sqrt, request->x_min, request->x_max,
+                                               request->y_min, request->y_max, &config);
+                if (results[i].points == 0) ret = -1;
+            }
+        }
+
+        DestroyThreadPool(config.pool);
+
+        double seconds  = (double)(GetTimeNs() - start) / 1e9;
+        size_t points   = 0;
+        double max_diff = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (mode == BATCH_PER_CALL) expected[i] = results[i].value;
+
+            points  += results[i].points;
+            max_diff = fmax(max_diff, fabs(results[i].value - expected[i]));
+            FreeIntegralResult(&results[i]);
+        }
+
+        if (ret == 0) {
+            fprintf(out, "%s,%d,%d,%zu,%.6lf,%zu,%lg\n", BATCH_MODE_NAMES[mode], threads, rep, n, seconds, points,
+                    max_diff);
+            fprintf(stderr, "%-9s %3d threads, rep %d: %zu integrals in %.4lf s\n", BATCH_MODE_NAMES[mode], threads,
+                    rep, n, seconds);
+        }
+    }
+
+    free(requests);
+    free(results);
+    free(expected);
+
+    return ret;
+}
+
+enum Generator {
+    GENERATOR_RAND_R,
+    GENERATOR_XOSHIRO,
+    GENERATOR_PHILOX,           // portable refill
+    GENERATOR_PHILOX_AVX2,
+    GENERATOR_PHILOX_AVX512,
+    GENERATOR_COUNT,
+};
+
+static const char *GENERATOR_NAMES[GENERATOR_COUNT] = {
+    "rand_r", "xoshiro256**", "philox", "philox-avx2", "philox-avx512",
+};
+
+/* draws RngUniform() values (rand_r() scaled to [0, 1)), the sum keeps the loop */
+static double Draw(enum Generator generator, uint64_t seed, size_t draws) {
+    double sum = 0;
+
+    if (generator == GENERATOR_RAND_R) {
+        unsigned state = (unsigned)seed;
+        for (size_t i = 0; i < draws; i++) {
+            sum += (double)rand_r(&state) / ((double)RAND_MAX + 1.0);
+        }
+        return sum;
+    }
+
+    Rng rng;
+    RngInit(&rng, (generator == GENERATOR_XOSHIRO) ? RNG_XOSHIRO : RNG_PHILOX, seed, 0);
+
+    if (generator == GENERATOR_PHILOX)        rng.refill = PhiloxRefill;
+    if (generator == GENERATOR_PHILOX_AVX2)   rng.refill = PhiloxRefillAvx2;
+    if (generator == GENERATOR_PHILOX_AVX512) rng.refill = PhiloxRefillAvx512;
+
+    for (size_t i = 0; i < draws; i++) {
+        sum += RngUniform(&rng);
+    }
+
+    return sum;
+}
+
+static int RunGenerators(FILE *out, const struct BenchOptions *options) {
+    __builtin_cpu_init();
+
+    int supported[GENERATOR_COUNT] = { 1, 1, 1, __builtin_cpu_supports("avx2"), __builtin_cpu_supports("avx512f") };
+
+    fprintf(out, "generator,rep,draws,seconds,mdraws_per_s\n");
+
+    for (int rep = 0; rep < options->reps; rep++) {
+        for (int g = 0; g < GENERATOR_COUNT; g++) {
+            if (!supported[g]) continue;
+
+            uint64_t start   = GetTimeNs();
+            double   sum     = Draw((enum Generator)g, options->config.seed, options->draws);
+            double   seconds = (double)(GetTimeNs() - start) / 1e9;
+
+            fprintf(out, "%s,%d,%zu,%.6lf,%.1lf\n", GENERATOR_NAMES[g], rep, options->draws, seconds,
+                    (double)options->draws / seconds / 1e6);
+            fprintf(stderr, "%-14s rep %d: %.4lf s, mean %.6lf\n", GENERATOR_NAMES[g], rep, seconds,
+                    sum / (double)options->draws);
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct BenchOptions options = {
+        .threads    = {1, 2, 4, 8},
+        .n_threads  = 4,
+        .policies   = {PLACEMENT_LINEAR},
+        .n_policies = 1,
+        .backends   = {BACKEND_THREADS},
+        .n_backends = 1,
+        .reps       = 3,
+        .cells_sqrt = 4,
+        .integrand  = "exp",
+        .config     = DefaultIntegralConfig(),
+    };
+    options.config.seed = 1;
+
+    if (ParseArgs(argc, argv, &options) == -1) {
+        return 1;
+    }
+
+    const struct Integrand *integrand = FindIntegrand(options.integrand);
+    if (integrand == NULL) {
+        fprintf(stderr, "unknown integrand '%s'\n", options.integrand);
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (options.output != NULL) {
+        out = fopen(options.output, "w");
+        if (out == NULL) {
+            fprintf(stderr, "failed to open %s\n", options.output);
+            return 1;
+        }
+    }
+
+    int ret = 0;
+    if (options.draws > 0) {
+        ret = RunGenerators(out, &options);
+    } else if (options.batch > 0) {
+        fprintf(out, "mode,threads,rep,integrals,seconds,points,max_diff\n");
+
+        for (int t = 0; t < options.n_threads && ret == 0; t++) {
+            for (int rep = 0; rep < options.reps && ret == 0; rep++) {
+                ret = RunBatches(out, &options, integrand, options.threads[t], rep);
+            }
+        }
+    } else {
+        fprintf(out, "backend,policy,threads,rep,seconds,points,worker,"
+                     "cycles,instructions,cache_misses,branch_misses\n");
+    }
+
+    for (int b = 0; b < options.n_backends && ret == 0 && options.batch == 0 && options.draws == 0; b++) {
+        for (int p = 0; p < options.n_policies && ret == 0; p++) {
+            for (int t = 0; t < options.n_threads && ret == 0; t++) {
+                for (int rep = 0; rep < options.reps && ret == 0; rep++) {
+                    ret = RunOnce(out, &options, integrand, options.backends[b], options.policies[p],
+                                  options.threads[t], rep);
+                }
+            }
+        }
+    }
+
+    if (out != stdout) fclose(out);
+
+    return (ret == 0) ? 0 : 1;
+}
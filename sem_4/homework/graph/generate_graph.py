@@ -1,3 +1,8 @@
+import csv
+import os
+import subprocess
+import sys
+
 import matplotlib.pyplot as plt
 from matplotlib import rcParams
 
@@ -5,25 +10,100 @@ plt.style.use('dark_background')
 rcParams['figure.figsize'] = 12, 6
 rcParams['font.size'] = 14
 
-threads         = [1, 4, 9, 16]
-execution_times = [0.355299, 0.278737, 0.179058, 0.118607]  
+# usage:
+#   python3 generate_graph.py                               - время от числа потоков (graph.png)
+#   python3 generate_graph.py bench.csv                     - масштабирование по политикам и счётчики (bench.png)
+#   python3 generate_graph.py bench.csv ../build/mc_bench 1 2 4 8
+#                                                           - сначала прогнать бенчмарк и записать csv
+
+POLICIES = ['linear', 'compact', 'scatter', 'physical', 'pcores']
+colors   = ['#FF6B6B', '#4ECDC4', '#45B7D1', '#96CEB4', '#FFEAA7', '#DDA0DD', '#F4A460', '#87CEFA', '#98FB98', '#F0E68C']
+
+
+def plot_time():
+    threads         = [1, 4, 9, 16]
+    execution_times = [0.355299, 0.278737, 0.179058, 0.118607]
+
+    fig, ax = plt.subplots(figsize=(14, 8))
+
+    bars = ax.bar(threads, execution_times, color=colors[:len(threads)], edgecolor='white', linewidth=2, alpha=0.8)
+    ax.set_xlabel('Количество потоков', fontsize=16, fontweight='bold')
+    ax.set_ylabel('Время выполнения (с)', fontsize=16, fontweight='bold')
+    ax.set_title('Зависимость времени выполнения от количества потоков',
+                 fontsize=18, fontweight='bold', pad=20)
+    ax.grid(True, alpha=0.3)
+    ax.set_xticks(threads)
+
+    for bar, time in zip(bars, execution_times):
+        height = bar.get_height()
+        ax.text(bar.get_x() + bar.get_width()/2., height + 0.005,
+                f'{time}с', ha='center', va='bottom', fontweight='bold', fontsize=12)
+
+    plt.savefig('graph.png')
+
+
+def run_bench(csv_path, binary, threads):
+    subprocess.run([binary, '-o', csv_path, '-t', ','.join(map(str, threads)), '-P', ','.join(POLICIES),
+                    '-k', 'threads,processes'], check=True)
+
+
+def mean(values):
+    values = [v for v in values if v >= 0]
+    return sum(values) / len(values) if values else None
+
+
+def plot_bench(csv_path):
+    # строки worker == all - сумма по потокам одного прогона, повторы усредняются
+    runs = {}
+    with open(csv_path) as file:
+        for row in csv.DictReader(file):
+            if row['worker'] != 'all':
+                continue
+            key = (row.get('backend', 'threads'), row['policy'], int(row['threads']))
+            runs.setdefault(key, []).append(row)
+
+    # подпись - политика, при нескольких бэкендах ещё и бэкенд
+    backends = {key[0] for key in runs}
+
+    series = {}
+    for (backend, policy, n), rows in runs.items():
+        throughput   = mean([int(r['points']) / float(r['seconds']) / 1e6 for r in rows])
+        cycles       = mean([int(r['cycles']) for r in rows])
+        instructions = mean([int(r['instructions']) for r in rows])
+        cache_misses = mean([int(r['cache_misses']) for r in rows])
+
+        ipc  = instructions / cycles if cycles and instructions is not None else None
+        mpki = cache_misses / instructions * 1000 if instructions and cache_misses is not None else None
+        label = policy if len(backends) == 1 else f'{backend} {policy}'
+        series.setdefault(label, []).append((n, throughput, ipc, mpki))
+
+    has_counters = any(p[2] is not None for points in series.values() for p in points)
+
+    fig, axes = plt.subplots(1, 3 if has_counters else 1, figsize=(24 if has_counters else 14, 8), squeeze=False)
+    panels = [(1, 'Пропускная способность (млн точек/с)')]
+    if has_counters:
+        panels += [(2, 'Инструкций за такт'), (3, 'Промахов кэша на 1000 инструкций')]
 
-colors = ['#FF6B6B', '#4ECDC4', '#45B7D1', '#96CEB4']
+    for ax, (column, label) in zip(axes[0], panels):
+        for color, (policy, points) in zip(colors, sorted(series.items())):
+            points = sorted(p for p in points if p[column] is not None)
+            ax.plot([p[0] for p in points], [p[column] for p in points],
+                    marker='o', linewidth=2, color=color, label=policy)
 
-fig, ax = plt.subplots(figsize=(14, 8))
+        ax.set_xlabel('Количество потоков', fontsize=16, fontweight='bold')
+        ax.set_ylabel(label, fontsize=16, fontweight='bold')
+        ax.grid(True, alpha=0.3)
+        ax.legend()
 
-bars = ax.bar(threads, execution_times, color=colors, edgecolor='white', linewidth=2, alpha=0.8)
-ax.set_xlabel('Количество потоков', fontsize=16, fontweight='bold')
-ax.set_ylabel('Время выполнения (с)', fontsize=16, fontweight='bold')
-ax.set_title('Зависимость времени выполнения от количества потоков', 
-             fontsize=18, fontweight='bold', pad=20)
-ax.grid(True, alpha=0.3)
-ax.set_xticks(threads)
+    fig.suptitle('Масштабирование при разных политиках размещения потоков', fontsize=18, fontweight='bold')
 
-for bar, time in zip(bars, execution_times):
-    height = bar.get_height()
-    ax.text(bar.get_x() + bar.get_width()/2., height + 0.005,
-            f'{time}с', ha='center', va='bottom', fontweight='bold', fontsize=12)
+    plt.savefig(os.path.splitext(csv_path)[0] + '.png')
 
-plt.savefig('graph.png')
 
+if __name__ == '__main__':
+    if len(sys.argv) == 1:
+        plot_time()
+    else:
+        if len(sys.argv) > 2:
+            run_bench(sys.argv[1], sys.argv[2], [int(n) for n in sys.argv[3:]] or [1, 2, 4, 8, 12])
+        plot_bench(sys.argv[1])
@@ -0,0 +1,62 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define CHECKPOINT_NAME_LEN 32
+
+/*
+    what the tasks of a run depend on: task t always draws stream t, so its hits
+    are the same whatever thread or process ran it. A file with another key is
+    never resumed
+*/
+struct CheckpointKey {
+    char                integrand[CHECKPOINT_NAME_LEN];
+    uint64_t            seed;
+    uint32_t            rng;
+    uint32_t            sampler;        // scalar or vector, double or float: they draw different points
+    uint64_t            n_strata;
+    uint64_t            points_per_stratum;
+    uint64_t            n_tasks;
+    uint64_t            stream_offset;      // stream of task 0
+    double              x_min, y_min;    // of the first stratum, the grid follows from the steps
+    double              x_step, y_step;
+};
+
+/*
+    finished tasks of one pass: a bit per task and its hits. Lives in MapShared()
+    memory, so the forked workers of the process backend mark their tasks too.
+    The file is the key, the bitmap and the hits of the marked tasks in task order,
+    written to path.tmp and renamed over path
+*/
+struct Checkpoint {
+    const char          *path;
+    size_t              map_size;
+    uint64_t            interval_ns;
+    _Alignas(64) _Atomic uint64_t next_write_ns;
+    _Atomic int         writing;            // one writer at a time, the others skip
+    struct CheckpointKey key;
+    _Atomic uint64_t    done[];             // (n_tasks + 63) / 64 words
+};
+
+/*
+    restores the tasks of an existing file with the same key into task_hits
+    (n_tasks entries) and counts them in *n_restored; no file - a fresh start.
+    NULL if the file belongs to another run or cannot be read
+*/
+struct Checkpoint*  OpenCheckpoint          (const char *path, double interval, const struct CheckpointKey *key,
+                                             size_t *task_hits, size_t *n_restored);
+
+/* after task_hits[task] is written; writes the file if the interval has passed */
+void                MarkCheckpointTask      (struct Checkpoint *checkpoint, const size_t *task_hits, size_t task);
+int                 WriteCheckpoint         (struct Checkpoint *checkpoint, const size_t *task_hits);
+void                CloseCheckpoint         (struct Checkpoint *checkpoint);
+
+static inline int CheckpointHasTask(const struct Checkpoint *checkpoint, size_t task) {
+    uint64_t word = atomic_load_explicit(&checkpoint->done[task / 64], memory_order_acquire);
+    return (int)((word >> (task % 64)) & 1);
+}
+
+#endif // CHECKPOINT_H
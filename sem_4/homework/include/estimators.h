@@ -0,0 +1,60 @@
+#ifndef ESTIMATORS_H
+#define ESTIMATORS_H
+
+#include "integrand.h"
+
+#define MAX_CONTROL_DEGREE 7
+
+/*
+    CalculateIntegral() samples u in [0, 1] (stratified), maps it to x = T(u)
+    and averages g(u) = f(T(u)) T'(u); the estimators differ in T and in what
+    is done with the samples
+*/
+enum Estimator {
+    ESTIMATOR_HIT_OR_MISS,      // y uniform in [0, y_max], fraction of the points under f
+    ESTIMATOR_MEAN_VALUE,       // mean of f, needs no bound
+    ESTIMATOR_ANTITHETIC,       // mean value over the pairs u, 1 - u (mirrored in the stratum)
+    ESTIMATOR_CONTROL_VARIATE,  // mean of f - c h with a known integral of h, c fitted per stratum
+    ESTIMATOR_IMPORTANCE,       // x from a proposal density p, mean of f / p
+    ESTIMATOR_COUNT,
+};
+
+/* h ~ f with a known antiderivative, the closer the smaller the variance */
+struct ControlVariate {
+    double      (*func)(double x, const void *arg);
+    double      (*antiderivative)(double x, const void *arg);
+    const void  *arg;
+};
+
+/* density on the integration interval, positive wherever f is not zero; quantile is the inverse CDF */
+struct Proposal {
+    double      (*density)(double x, const void *arg);
+    double      (*quantile)(double u, const void *arg);
+    const void  *arg;
+};
+
+/* sum coef[k] t^k, t = (x - center) / scale */
+struct PolynomialControl {
+    int         degree;
+    double      center, scale;
+    double      coef[MAX_CONTROL_DEGREE + 1];
+};
+
+/* density ~ e^(lambda x) on [x_min, x_max], uniform for lambda = 0 */
+struct ExponentialProposal {
+    double      lambda;
+    double      x_min, x_max;
+};
+
+int                     InterpolateControl      (const struct Integrand *integrand, double x_min, double x_max,
+                                                 int degree, struct PolynomialControl *poly);
+struct ControlVariate   PolynomialControlVariate(const struct PolynomialControl *poly);
+
+void                    FitExponentialProposal  (const struct Integrand *integrand, double x_min, double x_max,
+                                                 struct ExponentialProposal *params);
+struct Proposal         ExponentialProposalDensity(const struct ExponentialProposal *params);
+
+const char*             EstimatorName           (enum Estimator estimator);
+int                     ParseEstimator          (const char *name, enum Estimator *estimator);
+
+#endif // ESTIMATORS_H
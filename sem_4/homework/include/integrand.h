@@ -0,0 +1,90 @@
+#ifndef INTEGRAND_H
+#define INTEGRAND_H
+
+#include <stddef.h>
+
+struct Integrand;
+
+/* ys[i] = f(xs[i]) for a whole batch, one call instead of one per sample */
+typedef void (*IntegrandBatch)(const struct Integrand *self, const double *restrict xs,
+                               double *restrict ys, size_t n);
+
+/* the same in float32, twice the lanes per vector */
+typedef void (*IntegrandBatchF)(const struct Integrand *self, const float *restrict xs,
+                                float *restrict ys, size_t n);
+
+struct Integrand {
+    const char          *name;
+    double              (*func)(double);    // scalar form
+    IntegrandBatch      eval;
+    double              x_min, x_max;       // default interval
+    double              y_max;              // bound of f on it, f >= 0 there
+    int                 exp_kernel;         // f = e^x, the SIMD hit kernel computes it itself
+    IntegrandBatchF     eval_f;
+};
+
+/*
+    NAME##Func (scalar), NAME##Batch and NAME##BatchF (float32) for f(x) = EXPR,
+    EXPR is written in x. The batch loop sees EXPR itself instead of a pointer,
+    so the compiler can inline and vectorize it. integrand.c includes <tgmath.h>,
+    so the functions of EXPR follow the type of x; literals in EXPR should be
+    integers (x / 2, not x * 0.5) to keep the float32 form in float32
+*/
+#define DEFINE_INTEGRAND(NAME, EXPR)                                                    \
+    double NAME##Func(double x) {                                                       \
+        return (EXPR);                                                                  \
+    }                                                                                   \
+                                                                                        \
+    void NAME##Batch(const struct Integrand *self, const double *restrict xs,           \
+                     double *restrict ys, size_t n) {                                   \
+        (void)self;                                                                     \
+        for (size_t i = 0; i < n; i++) {                                                \
+            const double x = xs[i];                                                     \
+            ys[i] = (EXPR);                                                             \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    void NAME##BatchF(const struct Integrand *self, const float *restrict xs,           \
+                      float *restrict ys, size_t n) {                                   \
+        (void)self;                                                                     \
+        for (size_t i = 0; i < n; i++) {                                                \
+            const float x = xs[i];                                                      \
+            ys[i] = (float)(EXPR);                                                      \
+        }                                                                               \
+    }
+
+#define DECLARE_INTEGRAND(NAME)                                                         \
+    double NAME##Func (double x);                                                       \
+    void   NAME##Batch(const struct Integrand *self, const double *restrict xs,         \
+                       double *restrict ys, size_t n);                                  \
+    void   NAME##BatchF(const struct Integrand *self, const float *restrict xs,         \
+                        float *restrict ys, size_t n);
+
+DECLARE_INTEGRAND(Exponential)     // e^x
+DECLARE_INTEGRAND(Polynomial)      // x^3/2 - x^2 + x + 1
+DECLARE_INTEGRAND(Sine)            // sin x
+
+const struct Integrand* FindIntegrand       (const char *name);
+const struct Integrand* GetIntegrand        (size_t index);     // NULL past the last one
+struct Integrand        CallbackIntegrand   (const char *name, double (*func)(double),
+                                             double x_min, double x_max, double y_max);
+
+struct IntegrandNd;
+
+/* ys[i] = f(xs[0][i], ..., xs[dim-1][i]), coordinates are stored per dimension (SoA) */
+typedef void (*IntegrandNdBatch)(const struct IntegrandNd *self, int dim, const double *const *xs,
+                                 double *restrict ys, size_t n);
+
+struct IntegrandNd {
+    const char          *name;
+    IntegrandNdBatch    eval;
+    double              lo, hi;             // default box [lo, hi]^dim
+    double              y_max;              // bound of f on it for hit-or-miss, 0 <= f <= y_max
+    double              (*exact)(int dim);  // value over the default box, NULL - unknown
+    const struct Integrand *base;           // 1-D integrand this one was lifted from
+};
+
+const struct IntegrandNd* FindIntegrandNd   (const char *name);
+struct IntegrandNd        LiftIntegrand     (const struct Integrand *base);
+
+#endif // INTEGRAND_H
@@ -1,21 +1,284 @@
-#include <pthread.h>
+#ifndef MONTE_CARLO_H
+#define MONTE_CARLO_H
+
 #include <stdio.h>
 #include "stdlib.h"
 
-struct SharedData {
-    size_t          counter;
-    pthread_mutex_t mutex;
+#include "simd_kernel.h"
+#include "integrand.h"
+#include "rng.h"
+#include "thread_pool.h"
+#include "process_pool.h"
+#include "qmc.h"
+#include "estimators.h"
+#include "checkpoint.h"
+
+#define MAX_DIM 32
+#define MAX_INTEGRANDS 64               // CalculateMultiIntegral(): a hit mask per point fits a word
+#define MAX_DEPTH 16                    // adaptive refinement levels, a crossed cell becomes 4^16 at most
+
+extern const size_t TOTAL_POINTS;       // budget of one integration
+extern const size_t BATCH_POINTS;       // points per task
+
+enum Backend {
+    BACKEND_THREADS,            // worker threads sharing the address space
+    BACKEND_PROCESSES,          // forked workers, for integrands that are not thread-safe
+};
+
+/*
+    float32 sampling: points, integrand values and the comparison in single
+    precision (twice the SIMD lanes), hits counted in integers and the mean
+    value sums compensated (Kahan), so the accumulation adds no error of its own
+*/
+enum Precision {
+    PRECISION_DOUBLE,
+    PRECISION_FLOAT,            // integrands without eval_f run in double
+};
+
+/* [lo[0], hi[0]] x ... x [lo[dim-1], hi[dim-1]] */
+struct Box {
+    int                 dim;
+    double              lo[MAX_DIM];
+    double              hi[MAX_DIM];
+};
+
+/* running estimate of a progressive integration */
+struct IntegralProgress {
+    double              value;
+    double              half_width;         // of the 95% confidence interval
+    size_t              points;
+    double              seconds;
+};
+
+struct IntegralConfig {
+    uint64_t            seed;           // master seed, the same seed gives the same result
+    RngKind             rng;
+    size_t              max_points;     // budget, 0 - TOTAL_POINTS
+    int                 num_threads;    // workers, 0 - one per online core
+    enum Backend        backend;        // CalculateIntegral(): threads or processes
+    enum PlacementPolicy placement;     // CPUs of the workers
+    const struct PoolHooks *worker_hooks;   // NULL - none
+    struct ThreadPool   *pool;          // workers shared between calls, NULL - a pool per call;
+                                        // num_threads, placement and worker_hooks are then ignored
+
+    /* adaptive mode: pilot pass, then the rest of the budget goes where the variance is */
+    int                 adaptive;
+    int                 max_depth;      // quadtree refinement levels of the cells crossed by the curve,
+                                        // 0..MAX_DEPTH
+    double              target_error;   // stop at this standard error, 0 - spend the whole budget
+                                        // (also CachedIntegral() in the uniform mode)
+
+    /* progressive mode: stop as soon as the tolerance or the deadline is met */
+    int                 progressive;
+    double              tolerance;      // half width of the 95% confidence interval, 0 - none
+    double              deadline;       // seconds, 0 - none
+    void                (*on_progress)(const struct IntegralProgress *progress, void *arg);
+    void                *progress_arg;
+
+    enum Estimator      estimator;      // CalculateIntegralNd(): hit-or-miss or mean value only
+    const struct ControlVariate *control;   // ESTIMATOR_CONTROL_VARIATE
+    const struct Proposal *proposal;    // ESTIMATOR_IMPORTANCE, its support is the interval
+    enum Sequence       sequence;       // CalculateIntegralNd(): pseudo-random or quasi-random points
+    int                 replicas;       // QMC: independently shifted copies of the point set
+    enum Precision      precision;      // 1-D integrals only
+
+    /* uniform hit-or-miss CalculateIntegral(): finished tasks saved to a file, an existing one is resumed */
+    const char          *checkpoint;    // NULL - none
+    double              checkpoint_interval;    // seconds between writes, 0 - after every task
+
+    uint64_t            stream_offset;  // first RNG stream: a run continuing another one skips its streams
+};
+
+/* written by one worker only, padded so neighbours never share a cache line */
+struct WorkerAccum {
+    _Alignas(CACHE_LINE) size_t tasks;
+    size_t              points;
+    size_t              hits;
+    uint64_t            busy_ns;
+    double              est_sum;            // estimate of every task (hit fraction, mean sample), for the variance
+    double              est_sq_sum;
+};
+
+struct ThreadStats {
+    size_t              tasks;
+    size_t              points;
+    size_t              hits;
+    double              seconds;            // spent in tasks
+    double              variance;           // of the per-task estimate between the tasks of the thread
 };
 
-struct PthreadData {
-    double              (*func)(double);
-    double              x_min, x_max, y_min, y_max;
-    unsigned int        seed;
-    size_t              points_per_thread;
-    struct SharedData   *shared_data;
-    int                 assigned_core;
+struct IntegralResult {
+    double              value;
+    double              variance;           // of value, std_error^2
+    double              std_error;
+    size_t              points;
+    size_t              n_strata;
+    double              seconds;
+    int                 n_threads;
+    struct ThreadStats  *threads;           // n_threads entries, FreeIntegralResult() releases them
+    int                 stopped;            // progressive: stopped before the budget was spent
+    size_t              resumed_points;     // restored from the checkpoint, part of points
+    uint64_t            streams;            // RNG streams taken after config->stream_offset
+    size_t              cached_points;      // result cache: points of earlier runs, part of points
 };
 
-double ExponentialFunc      (double x);
-double CalculateIntegral    (double (*func)(double),int num_threads_sqrt,
-                             double x_min, double x_max, double y_min, double y_max);
+/* sub-box of the integration area with its own point budget */
+struct Stratum {
+    double              x_min, y_min;
+    double              x_step, y_step;
+    size_t              pass_points;        // points of the running pass
+    size_t              pass_hits;
+    size_t              points;             // of all finished passes
+    size_t              hits;
+};
+
+/*
+    one pass of CalculateIntegral(), read by all of its tasks.
+    Every stratum is split into batches of points, a task is one batch
+    and draws from its own RNG stream (stream_base + task index)
+*/
+struct IntegralJob {
+    const struct Integrand *integrand;
+    struct Stratum      *strata;
+    size_t              n_strata;
+    size_t              *first_task;        // first task of every stratum, n_strata + 1 entries
+    size_t              *task_hits;         // result slot of every task of the pass
+    size_t              stream_base;        // streams taken by the previous passes
+    struct IntegralConfig config;
+    struct WorkerAccum  *accum;             // one per worker, reduced after the last pass
+    int                 n_workers;
+    ExpHitKernel        kernel;             // vectorized path for ExponentialFunc, NULL - scalar loop
+    int                 use_float;          // float32 scalar loop (PRECISION_FLOAT and eval_f)
+    struct Checkpoint   *checkpoint;        // tasks of the pass already done, NULL - none
+    size_t              resumed_points;
+
+    /* progressive mode: task t samples stratum t % n_strata, workers publish after every batch */
+    _Atomic size_t      *published;         // row of (points, hits) per stratum for every worker
+    size_t              row_stride;
+    _Atomic size_t      tasks_done;
+    _Atomic int         stop;               // set by the coordinator, the remaining tasks are skipped
+};
+
+/* the tasks of all the integrals of a CalculateIntegrals() call, job i owns [first_task[i], first_task[i + 1]) */
+struct IntegralBatch {
+    struct IntegralJob  *jobs;
+    size_t              n_jobs;
+    size_t              *first_task;
+};
+
+/* sums of the samples g of a task and of the control variate samples h */
+struct MomentSums {
+    double              g, g2;
+    double              h, h2, gh;
+};
+
+/*
+    1-D estimators other than hit-or-miss: u in [0, 1] is split into n_strata
+    equal strata, every stratum into batch tasks, task t draws from stream t.
+    A point is one evaluation of f, an antithetic pair is two
+*/
+struct EstimatorJob {
+    const struct Integrand *integrand;
+    double              x_min, x_max;
+    size_t              n_strata;
+    size_t              samples_per_stratum;    // antithetic: pairs
+    size_t              batches_per_stratum;
+    struct MomentSums   *task_sums;             // result slot of every task
+    struct IntegralConfig config;
+    struct WorkerAccum  *accum;
+};
+
+/* one integral of a CalculateIntegrals() submission */
+struct IntegralRequest {
+    const struct Integrand *integrand;
+    int                 num_cells_sqrt;
+    double              x_min, x_max;
+    double              y_min, y_max;
+};
+
+/*
+    K integrands over one area, estimated from the same points: every stratum is
+    split into batch tasks, a task draws its chunk of points once and evaluates all
+    the integrands on it while it is in cache. Hits are kept as one bit per point,
+    so the joint hits of every pair (for the covariances) are popcounts of the ANDs
+*/
+struct MultiIntegralJob {
+    const struct Integrand *const *integrands;
+    size_t              n_integrands;
+    struct Stratum      *strata;
+    size_t              n_strata;
+    size_t              batches_per_cell;
+    size_t              points_per_cell;
+    size_t              *pair_hits;         // per worker and stratum: hits of both j and k, j <= k
+    size_t              row_stride;         // of a (worker, stratum) row, whole cache lines
+    struct IntegralConfig config;
+    struct WorkerAccum  *accum;
+};
+
+/* estimates of a CalculateMultiIntegral() call, correlated through the shared points */
+struct MultiIntegralResult {
+    size_t              n_integrands;
+    double              *values;
+    double              *covariance;        // n_integrands^2, row-major, the variances on the diagonal
+    size_t              points;             // of every integrand
+    size_t              n_strata;
+    double              seconds;
+    int                 n_threads;
+    struct ThreadStats  *threads;           // hits and variance of the first integrand
+};
+
+struct IntegralConfig DefaultIntegralConfig(void);
+
+/* sums of the samples of one task, a sample is y_max * hit or f(x) */
+struct TaskSum {
+    double              sum;
+    double              sum_sq;
+};
+
+/*
+    n-D integration: the box is bisected along its widest sides into equal
+    sub-boxes, at least one per worker, every sub-box is split into batch tasks.
+    QMC keeps the box whole: a "sub-box" is a replica there and its tasks are
+    disjoint index ranges of the sequence.
+    Samples are kept per coordinate (SoA) so the integrand loops vectorize
+*/
+struct IntegralNdJob {
+    const struct IntegrandNd *integrand;
+    struct Box          *sub_boxes;
+    size_t              n_sub_boxes;
+    size_t              points_per_box;     // QMC: per replica, a power of two
+    size_t              batches_per_box;
+    struct TaskSum      *task_sums;         // result slot of every task
+    struct IntegralConfig config;
+    struct WorkerAccum  *accum;
+};
+
+struct IntegralResult CalculateIntegral(const struct Integrand *integrand, int num_cells_sqrt,
+                                        double x_min, double x_max, double y_min, double y_max,
+                                        const struct IntegralConfig *config);
+/* called by CalculateIntegral() for every estimator but hit-or-miss, uniform mode only */
+struct IntegralResult CalculateIntegralEstimator(const struct Integrand *integrand, size_t n_strata,
+                                                 double x_min, double x_max, const struct IntegralConfig *config);
+
+/* results[i] of requests[i], seconds is the time of the whole submission; 0 or -1 if any failed */
+int    CalculateIntegrals   (const struct IntegralRequest *requests, size_t n_requests,
+                             struct IntegralResult *results, const struct IntegralConfig *config);
+/* uniform mode only, [x_min, x_max] x [y_min, y_max] must bound every integrand */
+struct MultiIntegralResult CalculateMultiIntegral(const struct Integrand *const *integrands, size_t n_integrands,
+                                                  int num_cells_sqrt, double x_min, double x_max,
+                                                  double y_min, double y_max, const struct IntegralConfig *config);
+double DifferenceError      (const struct MultiIntegralResult *result, size_t j, size_t k);
+void   FreeMultiIntegralResult(struct MultiIntegralResult *result);
+struct IntegralResult CalculateIntegralNd(const struct IntegrandNd *integrand, const struct Box *box,
+                                          const struct IntegralConfig *config);
+void   FreeIntegralResult   (struct IntegralResult *result);
+/* what draws the points of a task: bit 0 float, bit 1 the exp kernel; part of the checkpoint and cache keys */
+uint32_t SamplerId          (const struct Integrand *integrand, const struct IntegralConfig *config);
+
+const char* BackendName     (enum Backend backend);
+int    ParseBackend         (const char *name, enum Backend *backend);
+
+void   ReduceWorkerStats    (struct IntegralResult *result, const struct WorkerAccum *accum, int n_workers);
+uint64_t GetTimeNs          (void);
+
+#endif // MONTE_CARLO_H
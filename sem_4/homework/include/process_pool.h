@@ -0,0 +1,30 @@
+#ifndef PROCESS_POOL_H
+#define PROCESS_POOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "thread_pool.h"
+
+/*
+    work queue of a process job, mapped MAP_SHARED before the fork so the parent
+    and all the workers see the same counters (lock-free atomics work across processes)
+*/
+struct ProcessQueue {
+    _Alignas(CACHE_LINE) _Atomic size_t next;       // next task to hand out
+    _Alignas(CACHE_LINE) _Atomic size_t done;       // finished tasks
+    size_t                              n_tasks;
+};
+
+void*   MapShared       (size_t size);
+void    UnmapShared     (void *addr, size_t size);
+
+/*
+    forks n_workers processes (0 - one per online core) that take the tasks of the job
+    from a shared queue and exit, waits for them. A task sees the memory of the caller
+    as of the fork: anything it returns must be written to MapShared() memory.
+    -1 if a worker died or not every task ran
+*/
+int     RunProcessJob   (int n_workers, enum PlacementPolicy placement, const struct PoolJob *job);
+
+#endif // PROCESS_POOL_H
@@ -0,0 +1,43 @@
+#ifndef QMC_H
+#define QMC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rng.h"
+
+#define SOBOL_MAX_DIM   21      // Joe-Kuo direction numbers kept in qmc.c
+#define SOBOL_BITS      32
+#define HALTON_MAX_DIM  33
+
+enum Sequence {
+    SEQ_PSEUDO,     // the stream RNG
+    SEQ_SOBOL,      // Sobol in Gray code order, random linear matrix scramble and digital shift per replica
+    SEQ_HALTON,     // radical inverses in the first primes, random (Cranley-Patterson) rotation per replica
+};
+
+/*
+    randomized low-discrepancy point set: replicas are the same sequence under
+    independent random scrambles, so every replica is an unbiased estimate and
+    their spread gives the error. Any index range can be generated on its own,
+    so workers take disjoint ranges of one sequence
+*/
+struct QmcCursor {
+    enum Sequence   kind;
+    int             dim;
+    uint64_t        index;                      // of the next point
+    uint32_t        x[SOBOL_MAX_DIM];           // sobol: current point before the shift
+    uint32_t        direction[SOBOL_MAX_DIM][SOBOL_BITS];   // sobol: scrambled direction numbers
+    uint32_t        digital_shift[SOBOL_MAX_DIM];
+    double          rotation[HALTON_MAX_DIM];
+    uint64_t        radical[HALTON_MAX_DIM];    // halton: current point before the rotation, in 1 / p^K
+    uint8_t         digits[HALTON_MAX_DIM][64]; // halton: index in base PRIMES[d], lowest digit first
+};
+
+int         QmcMaxDim       (enum Sequence kind);
+int         QmcInit         (struct QmcCursor *cursor, enum Sequence kind, int dim,
+                             uint64_t seed, uint64_t replica, uint64_t index);
+void        QmcNext         (struct QmcCursor *cursor, double *point);
+const char* SequenceName    (enum Sequence kind);
+
+#endif // QMC_H
@@ -0,0 +1,68 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <stddef.h>
+
+#include "monte_carlo.h"
+
+#define RESULT_CACHE_NAME_LEN 32
+
+/*
+    what an estimate depends on besides its points: a refinement with the same
+    key continues the RNG streams of the entry, so old and new points never repeat
+*/
+struct ResultCacheKey {
+    char                integrand[RESULT_CACHE_NAME_LEN];
+    uint64_t            seed;
+    uint32_t            rng;
+    uint32_t            sampler;            // scalar or vector, double or float: they draw different points
+    uint32_t            estimator;
+    uint32_t            precision;
+    int32_t             num_cells_sqrt;
+    double              x_min, x_max;
+    double              y_min, y_max;
+};
+
+struct ResultCacheEntry {
+    struct ResultCacheKey key;
+    uint64_t            used;               // 0 - free slot
+    uint64_t            points;
+    uint64_t            streams;            // taken by all the runs of the entry
+    double              value;
+    double              variance;
+};
+
+/* file layout: the header, then capacity entries of an open-addressing table */
+struct ResultCacheHeader {
+    char                magic[8];
+    uint64_t            entry_size;
+    uint64_t            capacity;
+    uint64_t            count;
+};
+
+/* flock() orders the processes sharing the file, the mutex the threads sharing the mapping */
+struct ResultCache {
+    int                 fd;
+    pthread_mutex_t     lock;
+    size_t              map_size;
+    struct ResultCacheHeader *header;
+    struct ResultCacheEntry  *entries;
+};
+
+/* maps the file, created with room for capacity entries if it does not exist; NULL on error */
+struct ResultCache*     OpenResultCache     (const char *path, size_t capacity);
+void                    CloseResultCache    (struct ResultCache *cache);
+
+/*
+    CalculateIntegral() through the cache: an entry with config->max_points points
+    (or with config->target_error > 0, an error not above it) is returned at once,
+    a smaller one is refined by the missing points and merged. Uniform mode, the
+    hit-or-miss, mean-value and antithetic estimators; calls on one file are serialized
+*/
+struct IntegralResult   CachedIntegral      (struct ResultCache *cache, const struct Integrand *integrand,
+                                             int num_cells_sqrt, double x_min, double x_max,
+                                             double y_min, double y_max, const struct IntegralConfig *config);
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,86 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+#define PHILOX_BLOCKS 16    // blocks per refill: one AVX-512 vector of each word, two AVX2 ones
+
+/* Philox4x32-10 multipliers and key increments (Salmon et al., 2011) */
+#define PHILOX_M0       0xD2511F53u
+#define PHILOX_M1       0xCD9E8D57u
+#define PHILOX_W0       0x9E3779B9u
+#define PHILOX_W1       0xBB67AE85u
+#define PHILOX_ROUNDS   10
+
+typedef enum {
+    RNG_XOSHIRO,    // xoshiro256**, streams split further with XoshiroJump()
+    RNG_PHILOX,     // Philox4x32-10, counter based: (stream, index) -> random block
+} RngKind;
+
+/*
+    every (seed, stream) pair gives the same sequence on every run,
+    so work split into streams is reproducible whatever thread runs it
+*/
+typedef struct Rng Rng;
+
+/* the next PHILOX_BLOCKS output blocks, the block index is advanced past them */
+typedef void (*PhiloxRefillFn)(Rng *rng);
+
+struct Rng {
+    RngKind     kind;
+    uint64_t    s[4];       // xoshiro256** state
+    uint32_t    ctr[4];     // philox counter: block index, stream
+    uint32_t    key[2];     // philox key: seed
+    uint32_t    out[4 * PHILOX_BLOCKS];     // philox output blocks
+    unsigned    used;       // 64-bit words of out already consumed
+    PhiloxRefillFn refill;  // the widest one the CPU has, chosen by RngInit()
+};
+
+void        RngInit         (Rng *rng, RngKind kind, uint64_t seed, uint64_t stream);
+void        PhiloxRefill    (Rng *rng);     // portable, the vector ones are in simd_kernel.h
+
+uint64_t    SplitMix64      (uint64_t *state);
+void        XoshiroJump     (uint64_t s[4]);
+const char* RngName         (RngKind kind);
+
+/* the generators are called per sample, so they live here to be inlined */
+static inline uint64_t RngRotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t XoshiroNext(uint64_t s[4]) {
+    uint64_t result = RngRotl(s[1] * 5, 7) * 9;
+    uint64_t t      = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3]  = RngRotl(s[3], 45);
+
+    return result;
+}
+
+static inline uint64_t RngNext(Rng *rng) {
+    if (rng->kind == RNG_XOSHIRO) return XoshiroNext(rng->s);
+
+    if (rng->used == 2 * PHILOX_BLOCKS) rng->refill(rng);
+
+    uint64_t value = ((uint64_t)rng->out[2 * rng->used + 1] << 32) | rng->out[2 * rng->used];
+    rng->used++;
+
+    return value;
+}
+
+/* [0, 1) with 53 random bits */
+static inline double RngUniform(Rng *rng) {
+    return (double)(RngNext(rng) >> 11) * 0x1.0p-53;
+}
+
+/* the top 24 bits of the same word, so a float stream rounds the points of the double one */
+static inline float RngUniformF(Rng *rng) {
+    return (float)(RngNext(rng) >> 40) * 0x1.0p-24f;
+}
+
+#endif // RNG_H
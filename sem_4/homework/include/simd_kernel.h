@@ -0,0 +1,45 @@
+#ifndef SIMD_KERNEL_H
+#define SIMD_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+/*
+    hit-or-miss kernels for f(x) = e^x over [x_min,x_max]x[y_min,y_max]:
+    eight lanes of xoshiro256** (lane k is "state" jumped k times, point i
+    comes from lane i % 8), polynomial exp and mask compare, returns the number
+    of points under the curve. The layout does not depend on the vector width,
+    every kernel of one precision returns the same count for the same state
+*/
+typedef size_t (*ExpHitKernel)(double x_min, double x_max, double y_min, double y_max,
+                               size_t n_points, const uint64_t state[4]);
+
+size_t          ExpHitsScalar       (double x_min, double x_max, double y_min, double y_max,
+                                     size_t n_points, const uint64_t state[4]);
+size_t          ExpHitsAvx2         (double x_min, double x_max, double y_min, double y_max,
+                                     size_t n_points, const uint64_t state[4]);
+size_t          ExpHitsAvx512       (double x_min, double x_max, double y_min, double y_max,
+                                     size_t n_points, const uint64_t state[4]);
+
+/* float32 points and exp, two iterations per vector; the same points as the double kernels up to rounding */
+size_t          ExpHitsScalarF      (double x_min, double x_max, double y_min, double y_max,
+                                     size_t n_points, const uint64_t state[4]);
+size_t          ExpHitsAvx2F        (double x_min, double x_max, double y_min, double y_max,
+                                     size_t n_points, const uint64_t state[4]);
+size_t          ExpHitsAvx512F      (double x_min, double x_max, double y_min, double y_max,
+                                     size_t n_points, const uint64_t state[4]);
+
+/* best kernel supported by the CPU, NULL with MC_SIMD=off (use the generic scalar loop) */
+ExpHitKernel    SelectExpHitKernel  (void);
+ExpHitKernel    SelectExpHitKernelF (void);
+
+/* PhiloxRefill() on 8 and 16 blocks at a time, the same output */
+void            PhiloxRefillAvx2    (Rng *rng);
+void            PhiloxRefillAvx512  (Rng *rng);
+
+/* the refill RngInit() gives a Philox stream, MC_SIMD caps it like the kernels */
+PhiloxRefillFn  SelectPhiloxRefill  (void);
+
+#endif // SIMD_KERNEL_H
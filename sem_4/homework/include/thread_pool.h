@@ -0,0 +1,61 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "topology.h"
+
+#define CACHE_LINE 64
+
+/*
+    job = n_tasks independent tasks, run(ctx, task, worker) is called once per task.
+    Tasks are spread over per-worker deques in contiguous ranges,
+    an idle worker steals from the other end of someone else's deque
+*/
+struct PoolJob {
+    void    (*run)(void *ctx, size_t task, int worker);
+    void*   ctx;
+    size_t  n_tasks;
+};
+
+/* Chase-Lev deque of task indices with a fixed capacity */
+struct WorkDeque {
+    _Alignas(CACHE_LINE) _Atomic int64_t    top;        // thieves take from here
+    _Alignas(CACHE_LINE) _Atomic int64_t    bottom;     // the owner pushes and pops here
+    _Atomic size_t*                         buf;
+    int64_t                                 cap;
+};
+
+/* run on every worker thread itself: after it is pinned, and before it exits */
+struct PoolHooks {
+    void    (*start)(int worker, void *arg);
+    void    (*stop)(int worker, void *arg);
+    void*   arg;
+};
+
+struct ThreadPool {
+    int                 n_workers;
+    pthread_t*          tid;
+    int*                cpus;       // CPU of every worker, -1 - not pinned
+    struct WorkDeque*   deques;
+    pthread_barrier_t   start;      // job handoff: main + all workers
+    pthread_barrier_t   done;
+    pthread_mutex_t     init_lock;  // held while the workers are created
+    const struct PoolJob* job;
+    int                 stop;
+    struct PoolHooks    hooks;
+};
+
+struct ThreadPool*  CreateThreadPool    (int n_workers, enum PlacementPolicy placement,
+                                         const struct PoolHooks *hooks);
+void                DestroyThreadPool   (struct ThreadPool *pool);
+int                 RunPoolJob          (struct ThreadPool *pool, const struct PoolJob *job);
+int                 StartPoolJob        (struct ThreadPool *pool, const struct PoolJob *job);
+void                WaitPoolJob         (struct ThreadPool *pool);
+
+int                 GetNumCores         (void);
+
+#endif // THREAD_POOL_H
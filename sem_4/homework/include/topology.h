@@ -0,0 +1,29 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+/* order in which workers take the logical CPUs, read from /sys/devices/system/cpu */
+enum PlacementPolicy {
+    PLACEMENT_NONE,             // no pinning, the scheduler decides
+    PLACEMENT_LINEAR,           // worker k on the k-th online CPU
+    PLACEMENT_COMPACT,          // fill a core (SMT siblings), then its cluster, then the package
+    PLACEMENT_SCATTER,          // one core per L2 cluster and package in turn, siblings last
+    PLACEMENT_PHYSICAL_FIRST,   // every physical core once, then the SMT siblings
+    PLACEMENT_PCORES_FIRST,     // performance cores (physical first), then efficiency cores
+    PLACEMENT_COUNT,
+};
+
+struct CpuInfo {
+    int     cpu;
+    int     package;
+    int     cluster;            // CPUs sharing an L2 (E-core modules on hybrid parts), core_id if unknown
+    int     core;
+    int     smt_index;          // 0 for the first hardware thread of a core
+    int     pcore;              // 1 - performance core
+};
+
+int         ReadCpuTopology     (struct CpuInfo *cpus, int max_cpus);
+int         PlacementOrder      (enum PlacementPolicy policy, int *cpus, int max_cpus);
+const char* PlacementName       (enum PlacementPolicy policy);
+int         ParsePlacement      (const char *name, enum PlacementPolicy *policy);
+
+#endif // TOPOLOGY_H
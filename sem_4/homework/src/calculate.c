@@ -1,125 +1,993 @@
-#define _GNU_SOURCE
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#include <string.h>
 #include <time.h>
-#include <unistd.h>
 
 #include "monte_carlo.h"
 
-const size_t TOTAL_POINTS = 10000000;
+const size_t TOTAL_POINTS   = 10000000;
+const size_t BATCH_POINTS   = 1 << 16;
 
-static void* MonteCarloThread(void *args);
+const double PILOT_FRACTION = 0.1;     // of the budget spent on the pilot passes (adaptive mode)
+const size_t MIN_PILOT      = 256;     // points per stratum in a pilot pass
 
-double ExponentialFunc(double x) {
-    return exp(x);
+const uint64_t PROGRESS_POLL_NS = 1000000;  // coordinator period in progressive mode
+const double   CONFIDENCE_Z     = 1.96;     // 95% two-sided
+
+#define EVAL_CHUNK 256                  // samples per call of the batched integrand
+
+static size_t           SampleStratum   (const struct IntegralJob *job, const struct Stratum *cell,
+                                         size_t n_points, uint64_t stream);
+static void             AccountTask     (struct WorkerAccum *accum, size_t n_points, size_t hits, uint64_t start);
+static void             MonteCarloTask  (void *ctx, size_t task, int worker);
+static void             ProgressiveTask (void *ctx, size_t task, int worker);
+static void             BatchTask       (void *ctx, size_t task, int worker);
+static size_t           FindOwner       (const size_t *first_task, size_t n_owners, size_t task);
+static int              InitIntegralJob (struct IntegralJob *job, const struct IntegralRequest *request,
+                                         const struct IntegralConfig *config, int n_workers);
+static void             FinishIntegralJob(struct IntegralJob *job, struct IntegralResult *result, int n_workers);
+static int              BeginPass       (struct IntegralJob *job);
+static void             EndPass         (struct IntegralJob *job);
+static int              RunProcessPass  (struct IntegralJob *job, const struct PoolJob *pool_job);
+static int              OpenPassCheckpoint(struct IntegralJob *job);
+static int              RunPass         (struct ThreadPool *pool, struct IntegralJob *job);
+static int              RunProgressive  (struct ThreadPool *pool, struct IntegralJob *job, size_t budget,
+                                         int *stopped);
+static int              RefineStrata    (struct IntegralJob *job);
+static size_t           AllocateNeyman  (struct Stratum *strata, size_t n_strata, size_t budget,
+                                         size_t spent, double target_error);
+static double           StrataEstimate  (const struct Stratum *strata, size_t n_strata, double *variance);
+
+uint64_t GetTimeNs(void) {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
-static int set_this_thread_to_core(int core_num);
+/* hits of n_points points in the cell drawn from the given stream */
+static size_t SampleStratum(const struct IntegralJob *job, const struct Stratum *cell,
+                            size_t n_points, uint64_t stream) {
+    Rng rng = {};
+    RngInit(&rng, job->config.rng, job->config.seed, stream);
+
+    size_t local_count  = 0;
+
+    if (job->kernel != NULL) {
+        local_count = job->kernel(cell->x_min, cell->x_min + cell->x_step,
+                                  cell->y_min, cell->y_min + cell->y_step, n_points, rng.s);
+    } else if (job->use_float) {
+        float xs[EVAL_CHUNK], ys[EVAL_CHUNK], fx[EVAL_CHUNK];
+
+        float x_min = (float)cell->x_min, x_step = (float)cell->x_step;
+        float y_min = (float)cell->y_min, y_step = (float)cell->y_step;
+
+        for (size_t done = 0; done < n_points; done += EVAL_CHUNK) {
+            size_t chunk = (n_points - done < EVAL_CHUNK) ? n_points - done : EVAL_CHUNK;
+
+            for (size_t i = 0; i < chunk; i++) {
+                xs[i] = x_min + RngUniformF(&rng) * x_step;
+                ys[i] = y_min + RngUniformF(&rng) * y_step;
+            }
 
-static void* MonteCarloThread(void *args) {
-    assert(args);
+            job->integrand->eval_f(job->integrand, xs, fx, chunk);
 
-    struct PthreadData *data = (struct PthreadData*)args;
-    int err = set_this_thread_to_core(data->assigned_core);
-    if (err != 0) {
-        printf("Failed to create pthread on core\n");
-        return NULL;
+            for (size_t i = 0; i < chunk; i++) {
+                local_count += (ys[i] <= fx[i]);
+            }
+        }
+    } else {
+        double xs[EVAL_CHUNK], ys[EVAL_CHUNK], fx[EVAL_CHUNK];
+
+        for (size_t done = 0; done < n_points; done += EVAL_CHUNK) {
+            size_t chunk = (n_points - done < EVAL_CHUNK) ? n_points - done : EVAL_CHUNK;
+
+            for (size_t i = 0; i < chunk; i++) {
+                xs[i] = cell->x_min + RngUniform(&rng) * cell->x_step;
+                ys[i] = cell->y_min + RngUniform(&rng) * cell->y_step;
+            }
+
+            job->integrand->eval(job->integrand, xs, fx, chunk);
+
+            for (size_t i = 0; i < chunk; i++) {
+                local_count += (ys[i] <= fx[i]);
+            }
+        }
     }
-    size_t local_count  = 0;
 
-    for (size_t i = 0; i < data->points_per_thread; i++) {
-        double x = data->x_min + (double)rand_r(&data->seed) / RAND_MAX * (data->x_max - data->x_min);
-        double y = data->y_min + (double)rand_r(&data->seed) / RAND_MAX * (data->y_max - data->y_min);
+    return local_count;
+}
+
+static void AccountTask(struct WorkerAccum *accum, size_t n_points, size_t hits, uint64_t start) {
+    double frac = (double)hits / (double)n_points;
+
+    accum->tasks++;
+    accum->points       += n_points;
+    accum->hits         += hits;
+    accum->est_sum      += frac;
+    accum->est_sq_sum   += frac * frac;
+    accum->busy_ns      += GetTimeNs() - start;
+}
+
+static void MonteCarloTask(void *ctx, size_t task, int worker) {
+    assert(ctx);
+
+    struct IntegralJob *job   = (struct IntegralJob*)ctx;
+    uint64_t            start = GetTimeNs();
+    size_t              lo    = FindOwner(job->first_task, job->n_strata, task);
+
+    const struct Stratum *cell = &job->strata[lo];
+
+    /* restored from the checkpoint, the hits are already in the slot */
+    if (job->checkpoint != NULL && CheckpointHasTask(job->checkpoint, task)) return;
+
+    size_t first    = (task - job->first_task[lo]) * BATCH_POINTS;
+    size_t n_points = (cell->pass_points - first < BATCH_POINTS) ? cell->pass_points - first : BATCH_POINTS;
+
+    size_t hits = SampleStratum(job, cell, n_points, job->stream_base + task);
+
+    /* nothing shared is written: the task slot is ours, the accumulator is the worker's */
+    job->task_hits[task] = hits;
+    AccountTask(&job->accum[worker], n_points, hits, start);
+
+    if (job->checkpoint != NULL) MarkCheckpointTask(job->checkpoint, job->task_hits, task);
+}
+
+/* last owner whose first task is not after this one, empty owners are skipped */
+static size_t FindOwner(const size_t *first_task, size_t n_owners, size_t task) {
+    size_t lo = 0, hi = n_owners;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (first_task[mid] <= task) lo = mid;
+        else                         hi = mid;
+    }
+
+    return lo;
+}
+
+/* a task of the batch is a task of the pass of one of its integrals */
+static void BatchTask(void *ctx, size_t task, int worker) {
+    assert(ctx);
+
+    struct IntegralBatch *batch = (struct IntegralBatch*)ctx;
+    size_t                owner = FindOwner(batch->first_task, batch->n_jobs, task);
+
+    MonteCarloTask(&batch->jobs[owner], task - batch->first_task[owner], worker);
+}
+
+/* strata in turn, so every prefix of the tasks covers the whole area evenly */
+static void ProgressiveTask(void *ctx, size_t task, int worker) {
+    assert(ctx);
+
+    struct IntegralJob *job = (struct IntegralJob*)ctx;
+
+    if (!atomic_load_explicit(&job->stop, memory_order_relaxed)) {
+        uint64_t        start    = GetTimeNs();
+        size_t          cell     = task % job->n_strata;
+        size_t          n_points = job->strata[cell].pass_points;
+        _Atomic size_t *row      = &job->published[(size_t)worker * job->row_stride];
+
+        size_t hits = SampleStratum(job, &job->strata[cell], n_points, job->stream_base + task);
+
+        /* only this worker writes its row: points first, hits last with release for the coordinator */
+        atomic_fetch_add_explicit(&row[2 * cell],     n_points, memory_order_relaxed);
+        atomic_fetch_add_explicit(&row[2 * cell + 1], hits,     memory_order_release);
+
+        AccountTask(&job->accum[worker], n_points, hits, start);
+    }
+
+    atomic_fetch_add_explicit(&job->tasks_done, 1, memory_order_release);
+}
+
+/*
+    sums the published rows into the strata. Hits are read first with acquire, so the
+    points read after them include every batch those hits came from: a row may be one
+    batch ahead in points, never in hits, and p stays in [0, 1]. That only matters for
+    the running estimate, the final one is read after the workers stopped
+*/
+static void CollectPublished(struct IntegralJob *job, int n_workers) {
+    for (size_t i = 0; i < job->n_strata; i++) {
+        job->strata[i].points = 0;
+        job->strata[i].hits   = 0;
+
+        for (int w = 0; w < n_workers; w++) {
+            _Atomic size_t *row = &job->published[(size_t)w * job->row_stride];
+
+            size_t hits   = atomic_load_explicit(&row[2 * i + 1], memory_order_acquire);
+            size_t points = atomic_load_explicit(&row[2 * i],     memory_order_relaxed);
+
+            job->strata[i].points += points;
+            job->strata[i].hits   += (hits < points) ? hits : points;
+        }
+    }
+}
+
+/*
+    the budget as tasks of one batch per stratum; the calling thread becomes the coordinator:
+    it polls the published sums and stops the workers once the tolerance or the deadline is met
+*/
+static int RunProgressive(struct ThreadPool *pool, struct IntegralJob *job, size_t budget, int *stopped) {
+    assert(pool);
+    assert(job);
+    assert(stopped);
+
+    size_t batch   = (budget / job->n_strata < BATCH_POINTS) ? budget / job->n_strata : BATCH_POINTS;
+    size_t n_tasks = (batch > 0) ? budget / batch / job->n_strata * job->n_strata : 0;
+
+    for (size_t i = 0; i < job->n_strata; i++) {
+        job->strata[i].pass_points = batch;
+    }
+
+    int n_workers   = pool->n_workers;
+    job->row_stride = (2 * job->n_strata + CACHE_LINE / sizeof(size_t) - 1) /
+                      (CACHE_LINE / sizeof(size_t)) * (CACHE_LINE / sizeof(size_t));
+    job->published  = aligned_alloc(CACHE_LINE, (size_t)n_workers * job->row_stride * sizeof(*job->published));
+    if (job->published == NULL) {
+        fprintf(stderr, "failed to allocate memory for progress\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < (size_t)n_workers * job->row_stride; i++) {
+        atomic_init(&job->published[i], 0);
+    }
+    atomic_init(&job->tasks_done, 0);
+    atomic_init(&job->stop, 0);
+
+    struct PoolJob pool_job = {
+        .run        = ProgressiveTask,
+        .ctx        = job,
+        .n_tasks    = n_tasks,
+    };
+
+    uint64_t start = GetTimeNs();
+    if (n_tasks > 0 && StartPoolJob(pool, &pool_job) == -1) {
+        free(job->published);
+        job->published = NULL;
+        return -1;
+    }
+
+    while (n_tasks > 0 && atomic_load_explicit(&job->tasks_done, memory_order_acquire) < n_tasks) {
+        struct timespec poll = { .tv_nsec = (long)PROGRESS_POLL_NS };
+        nanosleep(&poll, NULL);
+
+        CollectPublished(job, n_workers);
+
+        struct IntegralProgress progress = {
+            .seconds = (double)(GetTimeNs() - start) / 1e9,
+        };
+
+        int all_sampled = 1;
+        for (size_t i = 0; i < job->n_strata; i++) {
+            if (job->strata[i].points == 0) all_sampled = 0;
+            progress.points += job->strata[i].points;
+        }
+        if (!all_sampled) continue;
+
+        double variance     = 0;
+        progress.value      = StrataEstimate(job->strata, job->n_strata, &variance);
+        progress.half_width = CONFIDENCE_Z * sqrt(variance);
+
+        if (job->config.on_progress != NULL) {
+            job->config.on_progress(&progress, job->config.progress_arg);
+        }
+
+        if ((job->config.tolerance > 0 && progress.half_width <= job->config.tolerance) ||
+            (job->config.deadline  > 0 && progress.seconds    >= job->config.deadline)) {
+            atomic_store_explicit(&job->stop, 1, memory_order_relaxed);
+            break;
+        }
+    }
+
+    if (n_tasks > 0) WaitPoolJob(pool);
+
+    CollectPublished(job, n_workers);
+
+    /* the stop may come after the last task has already started */
+    size_t sampled = 0;
+    for (size_t i = 0; i < job->n_strata; i++) {
+        sampled                   += job->strata[i].points;
+        job->strata[i].pass_points = 0;
+    }
+    *stopped = (sampled < n_tasks * batch);
+
+    /* the skipped tasks count too, so a continuation never repeats a stream */
+    job->stream_base += n_tasks;
+
+    free(job->published);
+    job->published = NULL;
+
+    return 0;
+}
+
+/* splits pass_points of every stratum into tasks and allocates their result slots */
+static int BeginPass(struct IntegralJob *job) {
+    assert(job);
+
+    size_t *first_task = calloc(job->n_strata + 1, sizeof(*first_task));
+    if (first_task == NULL) {
+        fprintf(stderr, "failed to allocate memory for tasks\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < job->n_strata; i++) {
+        first_task[i + 1] = first_task[i] + (job->strata[i].pass_points + BATCH_POINTS - 1) / BATCH_POINTS;
+    }
+
+    size_t *task_hits = calloc(first_task[job->n_strata] + 1, sizeof(*task_hits));
+    if (task_hits == NULL) {
+        fprintf(stderr, "failed to allocate memory for tasks\n");
+        free(first_task);
+        return -1;
+    }
+
+    job->first_task = first_task;
+    job->task_hits  = task_hits;
+
+    return 0;
+}
+
+/* moves the hits of the pass to the totals of the strata */
+static void EndPass(struct IntegralJob *job) {
+    assert(job);
+
+    /* reduction: the tasks of a stratum are contiguous */
+    for (size_t i = 0; i < job->n_strata; i++) {
+        job->strata[i].pass_hits = 0;
+        for (size_t task = job->first_task[i]; task < job->first_task[i + 1]; task++) {
+            job->strata[i].pass_hits += job->task_hits[task];
+        }
+
+        job->strata[i].points     += job->strata[i].pass_points;
+        job->strata[i].hits       += job->strata[i].pass_hits;
+        job->strata[i].pass_points = 0;
+    }
+
+    job->stream_base += job->first_task[job->n_strata];
+
+    free(job->first_task);
+    free(job->task_hits);
+    job->first_task = NULL;
+    job->task_hits  = NULL;
+}
+
+/* the result slots and the accumulators are moved to shared memory for the forked workers and back */
+static int RunProcessPass(struct IntegralJob *job, const struct PoolJob *pool_job) {
+    assert(job);
+    assert(pool_job);
+
+    size_t hits_size  = (pool_job->n_tasks + 1) * sizeof(*job->task_hits);
+    size_t accum_size = (size_t)job->n_workers * sizeof(*job->accum);
+
+    size_t             *task_hits = MapShared(hits_size);
+    struct WorkerAccum *accum     = MapShared(accum_size);
+    if (task_hits == NULL || accum == NULL) {
+        UnmapShared(task_hits, hits_size);
+        UnmapShared(accum, accum_size);
+        return -1;
+    }
+
+    memcpy(task_hits, job->task_hits, hits_size);
+    memcpy(accum, job->accum, accum_size);
+
+    size_t             *own_hits  = job->task_hits;
+    struct WorkerAccum *own_accum = job->accum;
+
+    job->task_hits = task_hits;
+    job->accum     = accum;
+
+    int ret = RunProcessJob(job->n_workers, job->config.placement, pool_job);
+
+    job->task_hits = own_hits;
+    job->accum     = own_accum;
+
+    if (ret == 0) {
+        memcpy(own_hits, task_hits, hits_size);
+        memcpy(own_accum, accum, accum_size);
+    }
+
+    UnmapShared(task_hits, hits_size);
+    UnmapShared(accum, accum_size);
+
+    return ret;
+}
+
+/*
+    the points a task draws depend on the sampler, not on the worker that runs it;
+    the kernels share one lane layout, so a run resumes on a CPU of another width.
+    Follows the choice of InitIntegralJob: float points, and the exp kernel on xoshiro
+*/
+uint32_t SamplerId(const struct Integrand *integrand, const struct IntegralConfig *config) {
+    assert(integrand);
+    assert(config);
+
+    int      use_float = (config->precision == PRECISION_FLOAT && integrand->eval_f != NULL);
+    uint32_t id        = use_float ? 1u : 0u;
+
+    if (integrand->exp_kernel && config->rng == RNG_XOSHIRO &&
+        (use_float ? SelectExpHitKernelF() : SelectExpHitKernel()) != NULL) {
+        id |= 2u;
+    }
+
+    return id;
+}
+
+/* restores the tasks of the pass saved by an earlier run with the same key */
+static int OpenPassCheckpoint(struct IntegralJob *job) {
+    assert(job);
+
+    struct CheckpointKey key;
+    memset(&key, 0, sizeof(key));
+
+    memcpy(key.integrand, job->integrand->name, strnlen(job->integrand->name, CHECKPOINT_NAME_LEN - 1));
+    key.seed                = job->config.seed;
+    key.rng                 = (uint32_t)job->config.rng;
+    key.sampler             = SamplerId(job->integrand, &job->config);
+    key.n_strata            = job->n_strata;
+    key.points_per_stratum  = job->strata[0].pass_points;
+    key.n_tasks             = job->first_task[job->n_strata];
+    key.stream_offset       = job->stream_base;
+    key.x_min               = job->strata[0].x_min;
+    key.y_min               = job->strata[0].y_min;
+    key.x_step              = job->strata[0].x_step;
+    key.y_step              = job->strata[0].y_step;
+
+    size_t n_restored = 0;
+    job->checkpoint   = OpenCheckpoint(job->config.checkpoint, job->config.checkpoint_interval, &key,
+                                       job->task_hits, &n_restored);
+    if (job->checkpoint == NULL) return -1;
+
+    for (size_t i = 0; i < job->n_strata && n_restored > 0; i++) {
+        for (size_t task = job->first_task[i]; task < job->first_task[i + 1]; task++) {
+            size_t first = (task - job->first_task[i]) * BATCH_POINTS;
+            size_t left  = job->strata[i].pass_points - first;
 
-        if (y <= data->func(x)) {
-            local_count++;
+            if (CheckpointHasTask(job->checkpoint, task)) {
+                job->resumed_points += (left < BATCH_POINTS) ? left : BATCH_POINTS;
+            }
         }
     }
 
-    pthread_mutex_lock  (&data->shared_data->mutex);
-    data->shared_data->counter += local_count;
-    pthread_mutex_unlock(&data->shared_data->mutex);
+    return 0;
+}
+
+/* samples pass_points in every stratum and moves them to the totals */
+static int RunPass(struct ThreadPool *pool, struct IntegralJob *job) {
+    assert(job);
+
+    if (BeginPass(job) == -1) return -1;
+
+    if (job->config.checkpoint != NULL && OpenPassCheckpoint(job) == -1) {
+        EndPass(job);
+        return -1;
+    }
+
+    struct PoolJob pool_job = {
+        .run        = MonteCarloTask,
+        .ctx        = job,
+        .n_tasks    = job->first_task[job->n_strata],
+    };
+
+    int ret = 0;
+    if (pool_job.n_tasks == 0) {
+        /* nothing to sample */
+    } else if (job->config.backend == BACKEND_PROCESSES) {
+        ret = RunProcessPass(job, &pool_job);
+    } else {
+        assert(pool);
+        ret = RunPoolJob(pool, &pool_job);
+    }
+
+    /* a finished run leaves a complete file, running it again only reads it */
+    if (job->checkpoint != NULL) {
+        if (ret == 0) ret = WriteCheckpoint(job->checkpoint, job->task_hits);
+
+        CloseCheckpoint(job->checkpoint);
+        job->checkpoint = NULL;
+    }
+
+    EndPass(job);
+
+    return ret;
+}
+
+/*
+    strata crossed by the curve (both hits and misses) are replaced by
+    their 4 quadrants with no samples, the others keep theirs
+*/
+static int RefineStrata(struct IntegralJob *job) {
+    assert(job);
+
+    size_t n_crossed = 0;
+    for (size_t i = 0; i < job->n_strata; i++) {
+        if (job->strata[i].hits > 0 && job->strata[i].hits < job->strata[i].points) n_crossed++;
+    }
+
+    size_t n_refined = job->n_strata + 3 * n_crossed;
+    struct Stratum *refined = calloc(n_refined, sizeof(*refined));
+    if (refined == NULL) {
+        fprintf(stderr, "failed to allocate memory for strata\n");
+        return -1;
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < job->n_strata; i++) {
+        const struct Stratum *cell = &job->strata[i];
+        if (cell->hits == 0 || cell->hits == cell->points) {
+            refined[k++] = *cell;
+            continue;
+        }
+
+        for (int q = 0; q < 4; q++) {
+            refined[k++] = (struct Stratum){
+                .x_min  = cell->x_min + (q % 2) * cell->x_step / 2,
+                .y_min  = cell->y_min + (q / 2) * cell->y_step / 2,
+                .x_step = cell->x_step / 2,
+                .y_step = cell->y_step / 2,
+            };
+        }
+    }
+
+    free(job->strata);
+    job->strata   = refined;
+    job->n_strata = n_refined;
+
+    return 0;
+}
+
+/*
+    Neyman allocation: n_i ~ area_i * sigma_i, sigma_i^2 = p_i (1 - p_i).
+    p_i is smoothed so a cell that got no hits (or only hits) in the pilot is not starved.
+    With a target error the size of the pass is the one expected to reach it,
+    (sum area_i sigma_i)^2 / target^2 points in total
+*/
+static size_t AllocateNeyman(struct Stratum *strata, size_t n_strata, size_t budget,
+                             size_t spent, double target_error) {
+    double weight_sum = 0;
+    for (size_t i = 0; i < n_strata; i++) {
+        double p = ((double)strata[i].hits + 0.5) / ((double)strata[i].points + 1);
+        weight_sum += strata[i].x_step * strata[i].y_step * sqrt(p * (1 - p));
+    }
+
+    if (weight_sum <= 0 || budget <= spent) return 0;
+
+    double extra = (double)(budget - spent);
+    if (target_error > 0) {
+        double needed = weight_sum * weight_sum / (target_error * target_error) - (double)spent;
+        extra = fmax(0, fmin(extra, needed));
+    }
+
+    size_t allocated = 0;
+    for (size_t i = 0; i < n_strata; i++) {
+        double p      = ((double)strata[i].hits + 0.5) / ((double)strata[i].points + 1);
+        double weight = strata[i].x_step * strata[i].y_step * sqrt(p * (1 - p));
 
-    return NULL;
+        strata[i].pass_points = (size_t)(extra * weight / weight_sum);
+        allocated += strata[i].pass_points;
+    }
+
+    return allocated;
 }
 
-double CalculateIntegral(double (*func)(double),
-                         int num_threads_sqrt,
-                         double x_min, double x_max,
-                         double y_min, double y_max) {
-    struct SharedData shared = {0};
+/*
+    a stratum with no hits or only hits may still be crossed by the curve in a corner
+    the points missed: its variance is taken at p = (h + 1) / (n + 2), not as 0
+*/
+static double StrataEstimate(const struct Stratum *strata, size_t n_strata, double *variance_out) {
+    double value    = 0;
+    double variance = 0;
 
-    pthread_mutex_init(&shared.mutex, NULL);
+    for (size_t i = 0; i < n_strata; i++) {
+        if (strata[i].points == 0) continue;
 
-    int num_threads = num_threads_sqrt * num_threads_sqrt;
-    double scale_step   = 1.0 / num_threads_sqrt;
-    double x_step       = (x_max - x_min) * scale_step;
-    double y_step       = (y_max - y_min) * scale_step;
+        double area = strata[i].x_step * strata[i].y_step;
+        double n    = (double)strata[i].points;
+        double p    = (double)strata[i].hits / n;
+        double p_v  = (strata[i].hits == 0 || strata[i].hits == strata[i].points) ?
+                      ((double)strata[i].hits + 1) / (n + 2) : p;
 
-    size_t points_per_thread = TOTAL_POINTS / (size_t)num_threads;
+        value    += area * p;
+        variance += area * area * p_v * (1 - p_v) / n;
+    }
 
-    struct PthreadData *data = calloc((size_t)num_threads, sizeof(*data));
-    pthread_t *tid           = calloc((size_t)num_threads, sizeof(*tid));
+    if (variance_out != NULL) *variance_out = variance;
+    return value;
+}
+
+struct IntegralConfig DefaultIntegralConfig(void) {
+    struct IntegralConfig config = {
+        .seed           = (uint64_t)time(NULL),
+        .rng            = RNG_XOSHIRO,
+        .max_points     = 0,
+        .num_threads    = 0,
+        .backend        = BACKEND_THREADS,
+        .placement      = PLACEMENT_LINEAR,
+        .worker_hooks   = NULL,
+        .pool           = NULL,
+        .adaptive       = 0,
+        .max_depth      = 0,
+        .target_error   = 0,
+        .progressive    = 0,
+        .tolerance      = 0,
+        .deadline       = 0,
+        .on_progress    = NULL,
+        .progress_arg   = NULL,
+        .estimator      = ESTIMATOR_HIT_OR_MISS,
+        .control        = NULL,
+        .proposal       = NULL,
+        .sequence       = SEQ_PSEUDO,
+        .replicas       = 16,
+        .precision      = PRECISION_DOUBLE,
+        .checkpoint     = NULL,
+        .checkpoint_interval = 60,
+        .stream_offset  = 0,
+    };
+
+    return config;
+}
+
+/* num_cells_sqrt^2 strata over the rectangle of the request, a zeroed accumulator per worker */
+static int InitIntegralJob(struct IntegralJob *job, const struct IntegralRequest *request,
+                           const struct IntegralConfig *config, int n_workers) {
+    assert(job);
+    assert(request);
+    assert(request->integrand);
+
+    size_t num_cells_sqrt = (size_t)request->num_cells_sqrt;
+    size_t num_cells      = num_cells_sqrt * num_cells_sqrt;
+    double scale_step     = 1.0 / (double)num_cells_sqrt;
+
+    *job = (struct IntegralJob){
+        .integrand          = request->integrand,
+        .n_strata           = num_cells,
+        .n_workers          = n_workers,
+        .config             = *config,
+        .use_float          = (config->precision == PRECISION_FLOAT && request->integrand->eval_f != NULL),
+        .stream_base        = config->stream_offset,
+    };
+
+    /* the vector kernel is built on xoshiro lanes, philox runs the scalar loop */
+    if (request->integrand->exp_kernel && config->rng == RNG_XOSHIRO) {
+        job->kernel = job->use_float ? SelectExpHitKernelF() : SelectExpHitKernel();
+    }
+
+    job->strata = calloc(num_cells, sizeof(*job->strata));
+    job->accum  = aligned_alloc(CACHE_LINE, (size_t)n_workers * sizeof(*job->accum));
+    if (job->strata == NULL || job->accum == NULL) {
+        fprintf(stderr, "failed to allocate memory for strata\n");
+        free(job->strata);
+        free(job->accum);
+        job->strata = NULL;
+        job->accum  = NULL;
+        return -1;
+    }
+
+    memset(job->accum, 0, (size_t)n_workers * sizeof(*job->accum));
+
+    for (size_t i = 0; i < num_cells; i++) {
+        struct Stratum *cell = &job->strata[i];
+
+        cell->x_step = (request->x_max - request->x_min) * scale_step;
+        cell->y_step = (request->y_max - request->y_min) * scale_step;
+        cell->x_min  = request->x_min + (double)(i / num_cells_sqrt) * cell->x_step;
+        cell->y_min  = request->y_min + (double)(i % num_cells_sqrt) * cell->y_step;
+    }
+
+    return 0;
+}
+
+/* the estimate of the sampled strata into result (NULL - a failed job), releases the job */
+static void FinishIntegralJob(struct IntegralJob *job, struct IntegralResult *result, int n_workers) {
+    assert(job);
+
+    if (result != NULL && job->strata != NULL) {
+        result->value     = StrataEstimate(job->strata, job->n_strata, &result->variance);
+        result->std_error = sqrt(result->variance);
+        result->n_strata  = job->n_strata;
+        ReduceWorkerStats(result, job->accum, n_workers);
+
+        result->points        += job->resumed_points;
+        result->resumed_points = job->resumed_points;
+        result->streams        = job->stream_base - job->config.stream_offset;
+    }
+
+    free(job->accum);
+    free(job->strata);
+    job->accum  = NULL;
+    job->strata = NULL;
+}
+
+struct IntegralResult CalculateIntegral(const struct Integrand *integrand,
+                                        int num_cells_sqrt,
+                                        double x_min, double x_max,
+                                        double y_min, double y_max,
+                                        const struct IntegralConfig *config) {
+    assert(integrand);
+
+    struct IntegralConfig defaults = DefaultIntegralConfig();
+    if (config == NULL) config = &defaults;
+
+    /* the other estimators stratify [x_min, x_max] only, y is not sampled */
+    if (config->estimator != ESTIMATOR_HIT_OR_MISS) {
+        return CalculateIntegralEstimator(integrand, (size_t)num_cells_sqrt * (size_t)num_cells_sqrt,
+                                          x_min, x_max, config);
+    }
 
-    struct timespec start = {}, end = {};
-    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct IntegralResult result = { .value = NAN };
 
-    int k = 0;
-    for (int i = 0; i < num_threads_sqrt; i++) {
-        for (int j = 0; j < num_threads_sqrt; j++) {
-            int index = i * num_threads_sqrt + j;
+    struct IntegralRequest request = {
+        .integrand      = integrand,
+        .num_cells_sqrt = num_cells_sqrt,
+        .x_min          = x_min,
+        .x_max          = x_max,
+        .y_min          = y_min,
+        .y_max          = y_max,
+    };
 
-            data[index].x_min               = x_min + i * x_step;
-            data[index].x_max               = x_min + (i + 1) * x_step;
-            data[index].y_min               = y_min + j * y_step;
-            data[index].y_max               = y_min + (j + 1) * y_step;
-            data[index].func                = func;
-            data[index].points_per_thread   = points_per_thread;
-            data[index].seed                = (unsigned int)time(NULL) + (unsigned int)index;
-            data[index].shared_data         = &shared;
-            data[index].assigned_core       = k;
+    uint64_t start  = GetTimeNs();
+    size_t   budget = (config->max_points > 0) ? config->max_points : TOTAL_POINTS;
 
-            #if 0
-            printf("Thread %d: [%.3f,%.3f]x[%.3f,%.3f]\n",
-                   index, data[index].x_min, data[index].x_max,
-                   data[index].y_min, data[index].y_max);
-            #endif
+    /* a shared pool outlives the call, its workers are only borrowed; processes are forked per pass */
+    int                processes = (config->backend == BACKEND_PROCESSES);
+    struct ThreadPool *pool      = (processes || config->pool != NULL) ? config->pool :
+                                   CreateThreadPool(config->num_threads, config->placement, config->worker_hooks);
 
-            pthread_create(&tid[k], NULL, MonteCarloThread, &data[index]);
-            k++;
+    int n_workers = processes ? ((config->num_threads > 0) ? config->num_threads : GetNumCores()) :
+                    (pool != NULL) ? pool->n_workers : 0;
+
+    struct IntegralJob job = {};
+    int ret = (n_workers > 0) ? InitIntegralJob(&job, &request, config, n_workers) : -1;
+
+    if (ret != 0) {
+        /* no workers or no strata, nothing to run */
+    } else if (config->progressive && processes) {
+        fprintf(stderr, "progressive mode needs the thread backend\n");
+        ret = -1;
+    } else if (config->adaptive && (config->max_depth < 0 || config->max_depth > MAX_DEPTH)) {
+        fprintf(stderr, "adaptive depth must be from 0 to %d\n", MAX_DEPTH);
+        ret = -1;
+    } else if (config->adaptive && budget < job.n_strata) {
+        fprintf(stderr, "adaptive mode needs at least one point per cell, %zu for %zu cells\n",
+                budget, job.n_strata);
+        ret = -1;
+    } else if (config->checkpoint != NULL && (config->progressive || config->adaptive)) {
+        fprintf(stderr, "checkpoints need the uniform mode\n");
+        ret = -1;
+    } else if (config->progressive) {
+        ret = RunProgressive(pool, &job, budget, &result.stopped);
+    } else if (!config->adaptive) {
+        for (size_t i = 0; i < job.n_strata; i++) {
+            job.strata[i].pass_points = budget / job.n_strata;
+        }
+        ret = RunPass(pool, &job);
+    } else {
+        /*
+            pilot passes take PILOT_FRACTION of the budget: every level an equal share of what is
+            left, at least MIN_PILOT points per new stratum, the crossed strata are refined in
+            between. The refinement stops at the level whose new strata the rest cannot pilot,
+            the first level samples every cell with what the whole budget allows (one point at least)
+        */
+        size_t pilot_budget = (size_t)((double)budget * PILOT_FRACTION);
+        size_t spent        = 0;
+
+        for (int level = 0; level <= config->max_depth && ret == 0; level++) {
+            size_t n_new = 0;
+            for (size_t i = 0; i < job.n_strata; i++) {
+                if (job.strata[i].points == 0) n_new++;
+            }
+
+            size_t left  = (spent < pilot_budget) ? pilot_budget - spent : 0;
+            size_t share = left / (size_t)(config->max_depth + 1 - level);
+            size_t pilot = (share / n_new > MIN_PILOT) ? share / n_new : MIN_PILOT;
+            if (pilot * n_new > budget - spent) pilot = (budget - spent) / n_new;
+
+            for (size_t i = 0; i < job.n_strata; i++) {
+                if (job.strata[i].points == 0) job.strata[i].pass_points = pilot;
+            }
+
+            ret    = RunPass(pool, &job);
+            spent += pilot * n_new;
+
+            if (ret != 0 || level == config->max_depth) break;
+
+            size_t n_crossed = 0;
+            for (size_t i = 0; i < job.n_strata; i++) {
+                if (job.strata[i].hits > 0 && job.strata[i].hits < job.strata[i].points) n_crossed++;
+            }
+
+            if (n_crossed == 0 || spent + 4 * n_crossed * MIN_PILOT > pilot_budget) break;
+
+            ret = RefineStrata(&job);
+        }
+
+        /* the first level fits as budget >= cells, the later ones as they stay within pilot_budget */
+        assert(spent <= budget);
+
+        if (ret == 0) {
+            AllocateNeyman(job.strata, job.n_strata, budget, spent, config->target_error);
+            ret = RunPass(pool, &job);
         }
     }
 
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(tid[i], NULL);
+    if (ret != 0) {
+        fprintf(stderr, "failed to run integration\n");
     }
 
-    pthread_mutex_destroy(&shared.mutex);
+    result.seconds = (double)(GetTimeNs() - start) / 1e9;
 
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    double duration = (double)(end.tv_sec  - start.tv_sec) +
-                      (double)(end.tv_nsec - start.tv_nsec) / 1e9;
-    printf("Time duration: %lg\n", duration);
+    FinishIntegralJob(&job, (ret == 0) ? &result : NULL, n_workers);
 
-    free(data);
-    free(tid);
+    if (pool != config->pool) DestroyThreadPool(pool);
 
-    return (x_max - x_min) * (y_max - y_min) * (double)shared.counter / (double)TOTAL_POINTS;
+    return result;
 }
 
-int set_this_thread_to_core(int core_num) {
-    int num_cores = sysconf(_SC_NPROCESSORS_ONLN);
-    //printf("Total number of cores: %d\n", num_cores);
-    if (core_num < 0 || core_num >= num_cores) {
+/*
+    uniform mode: the passes of all the integrals are one pool job, so the workers
+    are handed work once per submission and a short integral never waits for a barrier
+    of its own. The adaptive and progressive modes and the estimators other than hit-or-miss
+    run the integrals in turn on the same pool, the process backend in turn with its own workers.
+    Every result equals the one of a separate CalculateIntegral() with the same config
+*/
+int CalculateIntegrals(const struct IntegralRequest *requests, size_t n_requests,
+                       struct IntegralResult *results, const struct IntegralConfig *config) {
+    assert(requests);
+    assert(results);
+
+    struct IntegralConfig defaults = DefaultIntegralConfig();
+    if (config == NULL) config = &defaults;
+
+    for (size_t i = 0; i < n_requests; i++) {
+        results[i] = (struct IntegralResult){ .value = NAN };
+    }
+
+    /* one file holds the tasks of one integral */
+    if (config->checkpoint != NULL) {
+        fprintf(stderr, "checkpoints need a single CalculateIntegral() run\n");
         return -1;
     }
 
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(core_num, &cpuset);
+    uint64_t start = GetTimeNs();
+
+    struct IntegralConfig shared = *config;
+    if (shared.pool == NULL && config->backend == BACKEND_THREADS) {
+        shared.pool = CreateThreadPool(config->num_threads, config->placement, config->worker_hooks);
+        if (shared.pool == NULL) {
+            fprintf(stderr, "failed to run integration\n");
+            return -1;
+        }
+    }
+
+    int ret = 0;
+
+    if (config->adaptive || config->progressive || config->backend == BACKEND_PROCESSES ||
+        config->estimator != ESTIMATOR_HIT_OR_MISS) {
+        for (size_t i = 0; i < n_requests; i++) {
+            const struct IntegralRequest *request = &requests[i];
+
+            results[i] = CalculateIntegral(request->integrand, request->num_cells_sqrt,
+                                           request->x_min, request->x_max, request->y_min, request->y_max,
+                                           &shared);
+            if (results[i].points == 0) ret = -1;
+        }
+    } else {
+        size_t budget    = (config->max_points > 0) ? config->max_points : TOTAL_POINTS;
+        int    n_workers = shared.pool->n_workers;
+
+        struct IntegralBatch batch = {
+            .jobs       = calloc(n_requests + 1, sizeof(*batch.jobs)),
+            .n_jobs     = n_requests,
+            .first_task = calloc(n_requests + 1, sizeof(*batch.first_task)),
+        };
+
+        if (batch.jobs == NULL || batch.first_task == NULL) {
+            fprintf(stderr, "failed to allocate memory for batch\n");
+            ret = -1;
+        }
+
+        size_t n_begun = 0;
+        for (; n_begun < n_requests && ret == 0; n_begun++) {
+            struct IntegralJob *job = &batch.jobs[n_begun];
 
-    pthread_t current = pthread_self();
-    return pthread_setaffinity_np(current, sizeof(cpu_set_t), &cpuset);
+            ret = InitIntegralJob(job, &requests[n_begun], &shared, n_workers);
+            if (ret != 0) break;
+
+            for (size_t i = 0; i < job->n_strata; i++) {
+                job->strata[i].pass_points = budget / job->n_strata;
+            }
+
+            ret = BeginPass(job);
+            if (ret != 0) {
+                FinishIntegralJob(job, NULL, n_workers);
+                break;
+            }
+
+            batch.first_task[n_begun + 1] = batch.first_task[n_begun] + job->first_task[job->n_strata];
+        }
+
+        struct PoolJob pool_job = {
+            .run        = BatchTask,
+            .ctx        = &batch,
+            .n_tasks    = (ret == 0) ? batch.first_task[n_requests] : 0,
+        };
+
+        if (pool_job.n_tasks > 0) {
+            ret = RunPoolJob(shared.pool, &pool_job);
+        }
+
+        double seconds = (double)(GetTimeNs() - start) / 1e9;
+
+        for (size_t i = 0; i < n_begun; i++) {
+            EndPass(&batch.jobs[i]);
+
+            results[i].seconds = seconds;
+            FinishIntegralJob(&batch.jobs[i], (ret == 0) ? &results[i] : NULL, n_workers);
+        }
+
+        if (ret != 0) {
+            fprintf(stderr, "failed to run integration\n");
+        }
+
+        free(batch.jobs);
+        free(batch.first_task);
+    }
+
+    if (shared.pool != config->pool) DestroyThreadPool(shared.pool);
+
+    return ret;
+}
+
+/* final reduction of the per-worker accumulators into result->threads */
+void ReduceWorkerStats(struct IntegralResult *result, const struct WorkerAccum *accum, int n_workers) {
+    assert(result);
+    assert(accum);
+
+    result->threads = calloc((size_t)n_workers, sizeof(*result->threads));
+    if (result->threads == NULL) {
+        fprintf(stderr, "failed to allocate memory for thread stats\n");
+        return;
+    }
+    result->n_threads = n_workers;
+    result->points    = 0;
+
+    for (int w = 0; w < n_workers; w++) {
+        struct ThreadStats *stats = &result->threads[w];
+
+        stats->tasks    = accum[w].tasks;
+        stats->points   = accum[w].points;
+        stats->hits     = accum[w].hits;
+        stats->seconds  = (double)accum[w].busy_ns / 1e9;
+        if (accum[w].tasks > 1) {
+            double mean     = accum[w].est_sum / (double)accum[w].tasks;
+            stats->variance = (accum[w].est_sq_sum - mean * accum[w].est_sum) / (double)(accum[w].tasks - 1);
+        }
+
+        result->points += accum[w].points;
+    }
+}
+
+const char* BackendName(enum Backend backend) {
+    return (backend == BACKEND_PROCESSES) ? "processes" : "threads";
 }
 
+int ParseBackend(const char *name, enum Backend *backend) {
+    assert(name);
+    assert(backend);
+
+    if (strcmp(name, "threads") == 0) {
+        *backend = BACKEND_THREADS;
+    } else if (strcmp(name, "processes") == 0) {
+        *backend = BACKEND_PROCESSES;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+void FreeIntegralResult(struct IntegralResult *result) {
+    if (result == NULL) return;
+
+    free(result->threads);
+    result->threads   = NULL;
+    result->n_threads = 0;
+}
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "monte_carlo.h"
+
+#define ESTIMATOR_CHUNK 256             // samples per call of the batched integrand
+
+static void     KahanAdd            (double *sum, double *carry, double value);
+static void     EstimatorTask       (void *ctx, size_t task, int worker);
+
+/* compensated summation: carry keeps the low bits the last addition lost */
+static void KahanAdd(double *sum, double *carry, double value) {
+    double y = value - *carry;
+    double t = *sum + y;
+
+    *carry = (t - *sum) - y;
+    *sum   = t;
+}
+
+static void EstimatorTask(void *ctx, size_t task, int worker) {
+    assert(ctx);
+
+    struct EstimatorJob *job   = (struct EstimatorJob*)ctx;
+    uint64_t             start = GetTimeNs();
+
+    enum Estimator estimator = job->config.estimator;
+    int            pairs     = (estimator == ESTIMATOR_ANTITHETIC);
+    size_t         per_batch = pairs ? BATCH_POINTS / 2 : BATCH_POINTS;
+
+    size_t stratum   = task / job->batches_per_stratum;
+    size_t first     = (task % job->batches_per_stratum) * per_batch;
+    size_t n_samples = (job->samples_per_stratum - first < per_batch) ? job->samples_per_stratum - first : per_batch;
+
+    double u_min   = (double)stratum / (double)job->n_strata;
+    double u_width = 1.0 / (double)job->n_strata;
+    double width   = job->x_max - job->x_min;
+
+    const struct ControlVariate *control  = job->config.control;
+    const struct Proposal       *proposal = job->config.proposal;
+
+    /* float32: u from the top 24 bits of the same words, f evaluated in single precision */
+    int single = (job->config.precision == PRECISION_FLOAT && job->integrand->eval_f != NULL);
+
+    Rng rng = {};
+    RngInit(&rng, job->config.rng, job->config.seed, job->config.stream_offset + task);
+
+    /* antithetic: the mirrored points follow the direct ones in the same arrays */
+    double xs[2 * ESTIMATOR_CHUNK], fx[2 * ESTIMATOR_CHUNK], jacobian[ESTIMATOR_CHUNK];
+    float  xs_f[2 * ESTIMATOR_CHUNK], fx_f[2 * ESTIMATOR_CHUNK];
+
+    struct MomentSums sums = {}, carry = {};
+
+    for (size_t done = 0; done < n_samples; done += ESTIMATOR_CHUNK) {
+        size_t chunk = (n_samples - done < ESTIMATOR_CHUNK) ? n_samples - done : ESTIMATOR_CHUNK;
+
+        if (estimator == ESTIMATOR_IMPORTANCE) {
+            for (size_t i = 0; i < chunk; i++) {
+                double v = single ? (double)RngUniformF(&rng) : RngUniform(&rng);
+
+                xs[i]       = proposal->quantile(u_min + v * u_width, proposal->arg);
+                jacobian[i] = 1 / proposal->density(xs[i], proposal->arg);
+            }
+        } else {
+            for (size_t i = 0; i < chunk; i++) {
+                double v = single ? (double)RngUniformF(&rng) : RngUniform(&rng);
+
+                xs[i] = job->x_min + (u_min + v * u_width) * width;
+                if (pairs) xs[chunk + i] = job->x_min + (u_min + (1 - v) * u_width) * width;
+            }
+        }
+
+        size_t n_eval = pairs ? 2 * chunk : chunk;
+
+        if (single) {
+            for (size_t i = 0; i < n_eval; i++) xs_f[i] = (float)xs[i];
+            job->integrand->eval_f(job->integrand, xs_f, fx_f, n_eval);
+            for (size_t i = 0; i < n_eval; i++) fx[i] = (double)fx_f[i];
+        } else {
+            job->integrand->eval(job->integrand, xs, fx, n_eval);
+        }
+
+        for (size_t i = 0; i < chunk; i++) {
+            double g = 0, h = 0;
+
+            switch (estimator) {
+                case ESTIMATOR_ANTITHETIC:
+                    g = width * (fx[i] + fx[chunk + i]) / 2;
+                    break;
+                case ESTIMATOR_CONTROL_VARIATE:
+                    g = width * fx[i];
+                    h = width * control->func(xs[i], control->arg);
+                    break;
+                case ESTIMATOR_IMPORTANCE:
+                    g = fx[i] * jacobian[i];
+                    break;
+                case ESTIMATOR_HIT_OR_MISS:
+                case ESTIMATOR_MEAN_VALUE:
+                case ESTIMATOR_COUNT:
+                default:
+                    g = width * fx[i];
+                    break;
+            }
+
+            KahanAdd(&sums.g,  &carry.g,  g);
+            KahanAdd(&sums.g2, &carry.g2, g * g);
+            KahanAdd(&sums.h,  &carry.h,  h);
+            KahanAdd(&sums.h2, &carry.h2, h * h);
+            KahanAdd(&sums.gh, &carry.gh, g * h);
+        }
+    }
+
+    job->task_sums[task] = sums;
+
+    struct WorkerAccum *accum = &job->accum[worker];
+    double              mean  = sums.g / (double)n_samples;
+
+    accum->tasks++;
+    accum->points       += pairs ? 2 * n_samples : n_samples;
+    accum->est_sum      += mean;
+    accum->est_sq_sum   += mean * mean;
+    accum->busy_ns      += GetTimeNs() - start;
+}
+
+/*
+    stratum i of k gives (1/k) mean(g) with the variance (1/k)^2 s^2 / n.
+    Control variate: c = cov(g, h) / var(h) per stratum, the estimate is
+    mean(g) - c (mean(h) - H), H the exact mean of h over the stratum, and
+    the variance shrinks to s^2 (1 - rho^2)
+*/
+struct IntegralResult CalculateIntegralEstimator(const struct Integrand *integrand, size_t n_strata,
+                                                 double x_min, double x_max, const struct IntegralConfig *config) {
+    assert(integrand);
+    assert(config);
+
+    struct IntegralResult result = { .value = NAN };
+
+    enum Estimator estimator = config->estimator;
+    if (estimator <= ESTIMATOR_HIT_OR_MISS || estimator >= ESTIMATOR_COUNT) {
+        fprintf(stderr, "unknown estimator %d\n", (int)estimator);
+        return result;
+    }
+    if (config->adaptive || config->progressive || config->backend != BACKEND_THREADS ||
+        config->checkpoint != NULL) {
+        fprintf(stderr, "the %s estimator runs in the uniform mode on threads only, without checkpoints\n",
+                EstimatorName(estimator));
+        return result;
+    }
+    if ((estimator == ESTIMATOR_CONTROL_VARIATE && config->control == NULL) ||
+        (estimator == ESTIMATOR_IMPORTANCE && config->proposal == NULL)) {
+        fprintf(stderr, "the %s estimator needs a %s\n", EstimatorName(estimator),
+                (estimator == ESTIMATOR_IMPORTANCE) ? "proposal density" : "control variate");
+        return result;
+    }
+
+    uint64_t start     = GetTimeNs();
+    size_t   budget    = (config->max_points > 0) ? config->max_points : TOTAL_POINTS;
+    int      pairs     = (estimator == ESTIMATOR_ANTITHETIC);
+    size_t   per_batch = pairs ? BATCH_POINTS / 2 : BATCH_POINTS;
+
+    if (n_strata == 0) n_strata = 1;
+
+    struct ThreadPool *pool = (config->pool != NULL) ? config->pool :
+                              CreateThreadPool(config->num_threads, config->placement, config->worker_hooks);
+    if (pool == NULL) {
+        fprintf(stderr, "failed to run integration\n");
+        return result;
+    }
+
+    struct EstimatorJob job = {
+        .integrand              = integrand,
+        .x_min                  = x_min,
+        .x_max                  = x_max,
+        .n_strata               = n_strata,
+        .samples_per_stratum    = budget / n_strata / (pairs ? 2 : 1),
+        .config                 = *config,
+    };
+    job.batches_per_stratum = (job.samples_per_stratum + per_batch - 1) / per_batch;
+
+    size_t n_tasks = n_strata * job.batches_per_stratum;
+
+    job.task_sums = calloc(n_tasks + 1, sizeof(*job.task_sums));
+    job.accum     = aligned_alloc(CACHE_LINE, (size_t)pool->n_workers * sizeof(*job.accum));
+
+    int ret = -1;
+    if (job.task_sums != NULL && job.accum != NULL && job.samples_per_stratum > 1) {
+        memset(job.accum, 0, (size_t)pool->n_workers * sizeof(*job.accum));
+
+        struct PoolJob pool_job = {
+            .run        = EstimatorTask,
+            .ctx        = &job,
+            .n_tasks    = n_tasks,
+        };
+
+        ret = RunPoolJob(pool, &pool_job);
+    }
+
+    if (ret != 0) {
+        fprintf(stderr, "failed to run integration\n");
+    } else {
+        const struct ControlVariate *control = config->control;
+
+        double n        = (double)job.samples_per_stratum;
+        double weight   = 1.0 / (double)n_strata;
+        double value    = 0;
+        double variance = 0;
+
+        for (size_t i = 0; i < n_strata; i++) {
+            struct MomentSums sums = {};
+            for (size_t task = i * job.batches_per_stratum; task < (i + 1) * job.batches_per_stratum; task++) {
+                sums.g  += job.task_sums[task].g;
+                sums.g2 += job.task_sums[task].g2;
+                sums.h  += job.task_sums[task].h;
+                sums.h2 += job.task_sums[task].h2;
+                sums.gh += job.task_sums[task].gh;
+            }
+
+            /* a proposal proportional to f gives g = const, the rounding may leave var_g below 0 */
+            double mean_g = sums.g / n;
+            double var_g  = fmax(sums.g2 / n - mean_g * mean_g, 0) * n / (n - 1);
+            double mean   = mean_g;
+            double var    = var_g;
+
+            if (estimator == ESTIMATOR_CONTROL_VARIATE) {
+                double mean_h = sums.h / n;
+                double var_h  = (sums.h2 / n - mean_h * mean_h) * n / (n - 1);
+                double cov    = (sums.gh / n - mean_g * mean_h) * n / (n - 1);
+                double coef   = (var_h > 0) ? cov / var_h : 0;
+
+                /* the exact mean of h over the stratum, in the units of g */
+                double lo     = x_min + (double)i * weight * (x_max - x_min);
+                double hi     = lo + weight * (x_max - x_min);
+                double exact  = (control->antiderivative(hi, control->arg) -
+                                 control->antiderivative(lo, control->arg)) / weight;
+
+                mean = mean_g - coef * (mean_h - exact);
+                var  = fmax(var_g - coef * cov, 0);
+            }
+
+            value    += weight * mean;
+            variance += weight * weight * var / n;
+        }
+
+        result.value     = value;
+        result.variance  = variance;
+        result.std_error = sqrt(variance);
+        result.n_strata  = n_strata;
+        result.streams   = n_tasks;
+        ReduceWorkerStats(&result, job.accum, pool->n_workers);
+    }
+
+    result.seconds = (double)(GetTimeNs() - start) / 1e9;
+
+    if (pool != config->pool) DestroyThreadPool(pool);
+    free(job.accum);
+    free(job.task_sums);
+
+    return result;
+}
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "monte_carlo.h"
+
+#define MULTI_CHUNK 256                 // points drawn at once, evaluated by every integrand
+#define MASK_WORDS  (MULTI_CHUNK / 64)
+
+static void     MultiIntegralTask   (void *ctx, size_t task, int worker);
+static size_t   PairIndex           (size_t n, size_t j, size_t k);
+
+/* index of (j, k), j <= k, in the upper triangle of an n x n matrix stored by rows */
+static size_t PairIndex(size_t n, size_t j, size_t k) {
+    return j * n - j * (j - 1) / 2 + (k - j);
+}
+
+static void MultiIntegralTask(void *ctx, size_t task, int worker) {
+    assert(ctx);
+
+    struct MultiIntegralJob *job   = (struct MultiIntegralJob*)ctx;
+    uint64_t                 start = GetTimeNs();
+
+    size_t                cell_index = task / job->batches_per_cell;
+    const struct Stratum *cell       = &job->strata[cell_index];
+    size_t                n          = job->n_integrands;
+
+    size_t first    = (task % job->batches_per_cell) * BATCH_POINTS;
+    size_t n_points = (job->points_per_cell - first < BATCH_POINTS) ? job->points_per_cell - first : BATCH_POINTS;
+
+    /* the worker's own row: integer counts, so the reduction order does not matter */
+    size_t *pair_hits = &job->pair_hits[((size_t)worker * job->n_strata + cell_index) * job->row_stride];
+
+    Rng rng = {};
+    RngInit(&rng, job->config.rng, job->config.seed, job->config.stream_offset + task);
+
+    double   xs[MULTI_CHUNK], ys[MULTI_CHUNK], fx[MULTI_CHUNK];
+    uint64_t masks[MAX_INTEGRANDS][MASK_WORDS];
+    size_t   first_hits = 0;
+
+    for (size_t done = 0; done < n_points; done += MULTI_CHUNK) {
+        size_t chunk   = (n_points - done < MULTI_CHUNK) ? n_points - done : MULTI_CHUNK;
+        size_t n_words = (chunk + 63) / 64;
+
+        for (size_t i = 0; i < chunk; i++) {
+            xs[i] = cell->x_min + RngUniform(&rng) * cell->x_step;
+            ys[i] = cell->y_min + RngUniform(&rng) * cell->y_step;
+        }
+
+        for (size_t k = 0; k < n; k++) {
+            job->integrands[k]->eval(job->integrands[k], xs, fx, chunk);
+
+            for (size_t w = 0; w < n_words; w++) {
+                size_t   end  = (chunk - w * 64 < 64) ? chunk - w * 64 : 64;
+                uint64_t mask = 0;
+                for (size_t b = 0; b < end; b++) {
+                    mask |= (uint64_t)(ys[w * 64 + b] <= fx[w * 64 + b]) << b;
+                }
+                masks[k][w] = mask;
+            }
+        }
+
+        for (size_t j = 0; j < n; j++) {
+            for (size_t k = j; k < n; k++) {
+                size_t both = 0;
+                for (size_t w = 0; w < n_words; w++) {
+                    both += (size_t)__builtin_popcountll(masks[j][w] & masks[k][w]);
+                }
+                pair_hits[PairIndex(n, j, k)] += both;
+            }
+        }
+
+        for (size_t w = 0; w < n_words; w++) {
+            first_hits += (size_t)__builtin_popcountll(masks[0][w]);
+        }
+    }
+
+    /* per-thread stats follow the first integrand */
+    struct WorkerAccum *accum = &job->accum[worker];
+    double              frac  = (double)first_hits / (double)n_points;
+
+    accum->tasks++;
+    accum->points       += n_points;
+    accum->hits         += first_hits;
+    accum->est_sum      += frac;
+    accum->est_sq_sum   += frac * frac;
+    accum->busy_ns      += GetTimeNs() - start;
+}
+
+/*
+    stratified hit-or-miss for every integrand; with p_jk the fraction of
+    the points under both f_j and f_k, the covariance of two estimates is
+    sum over the strata of area^2 (p_jk - p_j p_k) / n
+*/
+struct MultiIntegralResult CalculateMultiIntegral(const struct Integrand *const *integrands, size_t n_integrands,
+                                                  int num_cells_sqrt, double x_min, double x_max,
+                                                  double y_min, double y_max, const struct IntegralConfig *config) {
+    assert(integrands);
+
+    struct IntegralConfig defaults = DefaultIntegralConfig();
+    if (config == NULL) config = &defaults;
+
+    struct MultiIntegralResult result = {};
+
+    if (n_integrands < 1 || n_integrands > MAX_INTEGRANDS || num_cells_sqrt < 1) {
+        fprintf(stderr, "%zu integrands are out of [1, %d]\n", n_integrands, MAX_INTEGRANDS);
+        return result;
+    }
+
+    uint64_t start   = GetTimeNs();
+    size_t   budget  = (config->max_points > 0) ? config->max_points : TOTAL_POINTS;
+    size_t   n       = n_integrands;
+    size_t   n_pairs = n * (n + 1) / 2;
+
+    if (config->estimator != ESTIMATOR_HIT_OR_MISS) {
+        fprintf(stderr, "integrands sharing points support the hit-or-miss estimator only\n");
+        return result;
+    }
+
+    if (config->backend != BACKEND_THREADS) {
+        fprintf(stderr, "only CalculateIntegral() supports the process backend\n");
+        return result;
+    }
+
+    if (config->precision != PRECISION_DOUBLE) {
+        fprintf(stderr, "only CalculateIntegral() supports float32 sampling\n");
+        return result;
+    }
+
+    if (config->checkpoint != NULL) {
+        fprintf(stderr, "only CalculateIntegral() supports checkpoints\n");
+        return result;
+    }
+
+    struct ThreadPool *pool = (config->pool != NULL) ? config->pool :
+                              CreateThreadPool(config->num_threads, config->placement, config->worker_hooks);
+    if (pool == NULL) {
+        fprintf(stderr, "failed to run integration\n");
+        return result;
+    }
+
+    size_t num_cells = (size_t)num_cells_sqrt * (size_t)num_cells_sqrt;
+    size_t per_line  = CACHE_LINE / sizeof(size_t);
+
+    struct MultiIntegralJob job = {
+        .integrands         = integrands,
+        .n_integrands       = n,
+        .n_strata           = num_cells,
+        .points_per_cell    = budget / num_cells,
+        .batches_per_cell   = (budget / num_cells + BATCH_POINTS - 1) / BATCH_POINTS,
+        .row_stride         = (n_pairs + per_line - 1) / per_line * per_line,
+        .config             = *config,
+    };
+
+    size_t n_rows = (size_t)pool->n_workers * num_cells;
+
+    job.strata     = calloc(num_cells, sizeof(*job.strata));
+    job.pair_hits  = aligned_alloc(CACHE_LINE, n_rows * job.row_stride * sizeof(*job.pair_hits));
+    job.accum      = aligned_alloc(CACHE_LINE, (size_t)pool->n_workers * sizeof(*job.accum));
+    result.values     = calloc(n, sizeof(*result.values));
+    result.covariance = calloc(n * n, sizeof(*result.covariance));
+
+    int ret = -1;
+    if (job.strata != NULL && job.pair_hits != NULL && job.accum != NULL &&
+        result.values != NULL && result.covariance != NULL) {
+        memset(job.pair_hits, 0, n_rows * job.row_stride * sizeof(*job.pair_hits));
+        memset(job.accum, 0, (size_t)pool->n_workers * sizeof(*job.accum));
+
+        double scale_step = 1.0 / num_cells_sqrt;
+        for (size_t i = 0; i < num_cells; i++) {
+            job.strata[i].x_step = (x_max - x_min) * scale_step;
+            job.strata[i].y_step = (y_max - y_min) * scale_step;
+            job.strata[i].x_min  = x_min + (double)(i / (size_t)num_cells_sqrt) * job.strata[i].x_step;
+            job.strata[i].y_min  = y_min + (double)(i % (size_t)num_cells_sqrt) * job.strata[i].y_step;
+        }
+
+        struct PoolJob pool_job = {
+            .run        = MultiIntegralTask,
+            .ctx        = &job,
+            .n_tasks    = num_cells * job.batches_per_cell,
+        };
+
+        ret = (pool_job.n_tasks > 0) ? RunPoolJob(pool, &pool_job) : -1;
+    }
+
+    if (ret != 0) {
+        fprintf(stderr, "failed to run integration\n");
+        free(result.values);
+        free(result.covariance);
+        result.values     = NULL;
+        result.covariance = NULL;
+    } else {
+        double points = (double)job.points_per_cell;
+        size_t hits[MAX_INTEGRANDS * (MAX_INTEGRANDS + 1) / 2];
+
+        for (size_t i = 0; i < num_cells; i++) {
+            memset(hits, 0, n_pairs * sizeof(*hits));
+            for (int w = 0; w < pool->n_workers; w++) {
+                const size_t *row = &job.pair_hits[((size_t)w * num_cells + i) * job.row_stride];
+                for (size_t pair = 0; pair < n_pairs; pair++) hits[pair] += row[pair];
+            }
+
+            double area = job.strata[i].x_step * job.strata[i].y_step;
+
+            for (size_t j = 0; j < n; j++) {
+                double p_j = (double)hits[PairIndex(n, j, j)] / points;
+                result.values[j] += area * p_j;
+
+                for (size_t k = j; k < n; k++) {
+                    double p_k  = (double)hits[PairIndex(n, k, k)] / points;
+                    double p_jk = (double)hits[PairIndex(n, j, k)] / points;
+                    double cov  = area * area * (p_jk - p_j * p_k) / points;
+
+                    result.covariance[j * n + k] += cov;
+                    if (k != j) result.covariance[k * n + j] += cov;
+                }
+            }
+        }
+
+        result.n_integrands = n;
+        result.n_strata     = num_cells;
+
+        struct IntegralResult stats = {};
+        ReduceWorkerStats(&stats, job.accum, pool->n_workers);
+        result.points    = stats.points;
+        result.n_threads = stats.n_threads;
+        result.threads   = stats.threads;
+    }
+
+    result.seconds = (double)(GetTimeNs() - start) / 1e9;
+
+    if (pool != config->pool) DestroyThreadPool(pool);
+    free(job.accum);
+    free(job.pair_hits);
+    free(job.strata);
+
+    return result;
+}
+
+/* standard error of values[j] - values[k], small when the two integrands are close */
+double DifferenceError(const struct MultiIntegralResult *result, size_t j, size_t k) {
+    assert(result);
+    assert(j < result->n_integrands && k < result->n_integrands);
+
+    size_t n        = result->n_integrands;
+    double variance = result->covariance[j * n + j] + result->covariance[k * n + k] -
+                      2 * result->covariance[j * n + k];
+
+    return sqrt(fmax(variance, 0));
+}
+
+void FreeMultiIntegralResult(struct MultiIntegralResult *result) {
+    if (result == NULL) return;
+
+    free(result->values);
+    free(result->covariance);
+    free(result->threads);
+    result->values       = NULL;
+    result->covariance   = NULL;
+    result->threads      = NULL;
+    result->n_integrands = 0;
+    result->n_threads    = 0;
+}
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "monte_carlo.h"
+
+#define ND_CHUNK 128                    // samples per call of the batched integrand
+
+static void     MonteCarloNdTask    (void *ctx, size_t task, int worker);
+static size_t   SplitBox            (const struct Box *box, size_t min_parts, struct Box **parts);
+static double   BoxVolume           (const struct Box *box);
+
+static double BoxVolume(const struct Box *box) {
+    double volume = 1;
+    for (int d = 0; d < box->dim; d++) {
+        volume *= box->hi[d] - box->lo[d];
+    }
+
+    return volume;
+}
+
+/* halves every part along its widest side until there are at least min_parts of them */
+static size_t SplitBox(const struct Box *box, size_t min_parts, struct Box **parts) {
+    size_t n_parts = 1;
+    while (n_parts < min_parts) n_parts *= 2;
+
+    *parts = calloc(n_parts, sizeof(**parts));
+    if (*parts == NULL) {
+        fprintf(stderr, "failed to allocate memory for sub-boxes\n");
+        return 0;
+    }
+
+    (*parts)[0] = *box;
+
+    for (size_t count = 1; count < n_parts; count *= 2) {
+        for (size_t i = 0; i < count; i++) {
+            struct Box *part = &(*parts)[i];
+
+            int widest = 0;
+            for (int d = 1; d < part->dim; d++) {
+                if (part->hi[d] - part->lo[d] > part->hi[widest] - part->lo[widest]) widest = d;
+            }
+
+            double middle = (part->lo[widest] + part->hi[widest]) / 2;
+
+            (*parts)[count + i]             = *part;
+            (*parts)[count + i].lo[widest]  = middle;
+            part->hi[widest]                = middle;
+        }
+    }
+
+    return n_parts;
+}
+
+static void MonteCarloNdTask(void *ctx, size_t task, int worker) {
+    assert(ctx);
+
+    struct IntegralNdJob *job   = (struct IntegralNdJob*)ctx;
+    uint64_t              start = GetTimeNs();
+
+    const struct Box *box = &job->sub_boxes[task / job->batches_per_box];
+    int               dim = box->dim;
+
+    size_t first    = (task % job->batches_per_box) * BATCH_POINTS;
+    size_t n_points = (job->points_per_box - first < BATCH_POINTS) ? job->points_per_box - first : BATCH_POINTS;
+
+    double  y_max       = job->integrand->y_max;
+    int     hit_or_miss = (job->config.estimator == ESTIMATOR_HIT_OR_MISS);
+    int     qmc         = (job->config.sequence != SEQ_PSEUDO);
+
+    Rng              rng    = {};
+    struct QmcCursor cursor = {};
+    if (qmc) {
+        /* the height of a hit-or-miss point is one more coordinate of the sequence */
+        QmcInit(&cursor, job->config.sequence, dim + hit_or_miss, job->config.seed,
+                task / job->batches_per_box, first);
+    } else {
+        RngInit(&rng, job->config.rng, job->config.seed, job->config.stream_offset + task);
+    }
+
+    /* SoA: one row of ND_CHUNK samples per coordinate */
+    double          coords[MAX_DIM][ND_CHUNK];
+    const double    *rows[MAX_DIM];
+    double          heights[ND_CHUNK];      // hit-or-miss y / y_max
+    double          fx[ND_CHUNK];
+    double          point[MAX_DIM + 1];
+
+    for (int d = 0; d < dim; d++) rows[d] = coords[d];
+
+    size_t  hits        = 0;
+    double  sum         = 0;
+    double  sum_sq      = 0;
+
+    for (size_t done = 0; done < n_points; done += ND_CHUNK) {
+        size_t chunk = (n_points - done < ND_CHUNK) ? n_points - done : ND_CHUNK;
+
+        if (qmc) {
+            for (size_t i = 0; i < chunk; i++) {
+                QmcNext(&cursor, point);
+                for (int d = 0; d < dim; d++) {
+                    coords[d][i] = box->lo[d] + point[d] * (box->hi[d] - box->lo[d]);
+                }
+                heights[i] = point[dim];
+            }
+        } else {
+            for (int d = 0; d < dim; d++) {
+                double lo    = box->lo[d];
+                double width = box->hi[d] - box->lo[d];
+                for (size_t i = 0; i < chunk; i++) {
+                    coords[d][i] = lo + RngUniform(&rng) * width;
+                }
+            }
+
+            for (size_t i = 0; i < chunk && hit_or_miss; i++) {
+                heights[i] = RngUniform(&rng);
+            }
+        }
+
+        job->integrand->eval(job->integrand, dim, rows, fx, chunk);
+
+        if (hit_or_miss) {
+            for (size_t i = 0; i < chunk; i++) {
+                hits += (heights[i] * y_max <= fx[i]);
+            }
+        } else {
+            for (size_t i = 0; i < chunk; i++) {
+                sum    += fx[i];
+                sum_sq += fx[i] * fx[i];
+            }
+        }
+    }
+
+    /* a hit-or-miss sample is y_max or 0 */
+    if (hit_or_miss) {
+        sum    = (double)hits * y_max;
+        sum_sq = (double)hits * y_max * y_max;
+    }
+
+    job->task_sums[task].sum    = sum;
+    job->task_sums[task].sum_sq = sum_sq;
+
+    struct WorkerAccum *accum = &job->accum[worker];
+    double              mean  = sum / (double)n_points;
+
+    accum->tasks++;
+    accum->points       += n_points;
+    accum->hits         += hits;
+    accum->est_sum      += mean;
+    accum->est_sq_sum   += mean * mean;
+    accum->busy_ns      += GetTimeNs() - start;
+}
+
+struct IntegralResult CalculateIntegralNd(const struct IntegrandNd *integrand, const struct Box *box,
+                                          const struct IntegralConfig *config) {
+    assert(integrand);
+    assert(box);
+
+    struct IntegralConfig defaults = DefaultIntegralConfig();
+    if (config == NULL) config = &defaults;
+
+    struct IntegralResult result = { .value = NAN };
+
+    if (config->estimator != ESTIMATOR_HIT_OR_MISS && config->estimator != ESTIMATOR_MEAN_VALUE) {
+        fprintf(stderr, "n-D integration supports the hit-or-miss and mean-value estimators only\n");
+        return result;
+    }
+
+    if (box->dim < 1 || box->dim > MAX_DIM) {
+        fprintf(stderr, "dimension %d is out of [1, %d]\n", box->dim, MAX_DIM);
+        return result;
+    }
+
+    uint64_t start = GetTimeNs();
+
+    if (config->backend != BACKEND_THREADS) {
+        fprintf(stderr, "only CalculateIntegral() supports the process backend\n");
+        return result;
+    }
+
+    if (config->precision != PRECISION_DOUBLE) {
+        fprintf(stderr, "only CalculateIntegral() supports float32 sampling\n");
+        return result;
+    }
+
+    if (config->checkpoint != NULL) {
+        fprintf(stderr, "only CalculateIntegral() supports checkpoints\n");
+        return result;
+    }
+
+    struct ThreadPool *pool = (config->pool != NULL) ? config->pool :
+                              CreateThreadPool(config->num_threads, config->placement, config->worker_hooks);
+    if (pool == NULL) {
+        fprintf(stderr, "failed to run integration\n");
+        return result;
+    }
+
+    struct IntegralNdJob job = {
+        .integrand  = integrand,
+        .config     = *config,
+    };
+
+    int    qmc    = (config->sequence != SEQ_PSEUDO);
+    size_t budget = (config->max_points > 0) ? config->max_points : TOTAL_POINTS;
+
+    if (qmc) {
+        job.n_sub_boxes = (size_t)((config->replicas > 1) ? config->replicas : 2);
+        job.sub_boxes   = calloc(job.n_sub_boxes, sizeof(*job.sub_boxes));
+        for (size_t r = 0; r < job.n_sub_boxes && job.sub_boxes != NULL; r++) {
+            job.sub_boxes[r] = *box;
+        }
+
+        /* sobol nets are balanced on power of two prefixes */
+        job.points_per_box = 1;
+        while (job.points_per_box * 2 <= budget / job.n_sub_boxes) job.points_per_box *= 2;
+    } else {
+        job.n_sub_boxes    = SplitBox(box, (size_t)pool->n_workers, &job.sub_boxes);
+        job.points_per_box = (job.n_sub_boxes > 0) ? budget / job.n_sub_boxes : 0;
+    }
+
+    job.batches_per_box = (job.points_per_box + BATCH_POINTS - 1) / BATCH_POINTS;
+
+    size_t n_tasks = job.n_sub_boxes * job.batches_per_box;
+
+    job.task_sums = calloc(n_tasks + 1, sizeof(*job.task_sums));
+    job.accum     = aligned_alloc(CACHE_LINE, (size_t)pool->n_workers * sizeof(*job.accum));
+
+    int ret = -1;
+    if (qmc && box->dim + (config->estimator == ESTIMATOR_HIT_OR_MISS) > QmcMaxDim(config->sequence)) {
+        fprintf(stderr, "%s supports %d dimensions (hit-or-miss takes one more)\n",
+                SequenceName(config->sequence), QmcMaxDim(config->sequence));
+    } else if (job.sub_boxes != NULL && job.task_sums != NULL && job.accum != NULL && n_tasks > 0) {
+        memset(job.accum, 0, (size_t)pool->n_workers * sizeof(*job.accum));
+
+        struct PoolJob pool_job = {
+            .run        = MonteCarloNdTask,
+            .ctx        = &job,
+            .n_tasks    = n_tasks,
+        };
+
+        ret = RunPoolJob(pool, &pool_job);
+    }
+
+    if (ret != 0) {
+        fprintf(stderr, "failed to run integration\n");
+    } else {
+        /*
+            pseudo-random: every sub-box is a stratum, volume * mean, volume^2 * sample variance / n.
+            QMC: the points of a replica are not independent, only the replicas are,
+            so the error comes from the spread of the replica estimates
+        */
+        double value    = 0;
+        double variance = 0;
+        double rep_sq   = 0;
+        double n        = (double)job.points_per_box;
+
+        for (size_t b = 0; b < job.n_sub_boxes; b++) {
+            double sum = 0, sum_sq = 0;
+            for (size_t task = b * job.batches_per_box; task < (b + 1) * job.batches_per_box; task++) {
+                sum    += job.task_sums[task].sum;
+                sum_sq += job.task_sums[task].sum_sq;
+            }
+
+            double volume = BoxVolume(&job.sub_boxes[b]);
+            double mean   = sum / n;
+
+            /* one point per sub-box has no sample variance; rounding can push the spread below 0 */
+            double spread = fmax(sum_sq / n - mean * mean, 0.0);
+
+            value    += volume * mean;
+            variance += (n > 1) ? volume * volume * spread / (n - 1) : 0.0;
+            rep_sq   += volume * mean * volume * mean;
+        }
+
+        if (qmc) {
+            double replicas = (double)job.n_sub_boxes;
+
+            value   /= replicas;
+            variance = fmax(rep_sq / replicas - value * value, 0.0) / (replicas - 1);
+        }
+
+        result.value     = value;
+        result.variance  = variance;
+        result.std_error = sqrt(variance);
+        result.n_strata  = job.n_sub_boxes;
+        result.streams   = n_tasks;
+        ReduceWorkerStats(&result, job.accum, pool->n_workers);
+    }
+
+    result.seconds = (double)(GetTimeNs() - start) / 1e9;
+
+    if (pool != config->pool) DestroyThreadPool(pool);
+    free(job.accum);
+    free(job.task_sums);
+    free(job.sub_boxes);
+
+    return result;
+}
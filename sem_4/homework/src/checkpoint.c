@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "monte_carlo.h"
+
+static const char CHECKPOINT_MAGIC[8] = "MCCKPT1";
+
+static size_t   NumWords        (const struct Checkpoint *checkpoint);
+static int      ReadCheckpoint  (struct Checkpoint *checkpoint, size_t *task_hits, size_t *n_restored);
+
+static size_t NumWords(const struct Checkpoint *checkpoint) {
+    return (size_t)((checkpoint->key.n_tasks + 63) / 64);
+}
+
+/* 0 with nothing restored if there is no file yet */
+static int ReadCheckpoint(struct Checkpoint *checkpoint, size_t *task_hits, size_t *n_restored) {
+    FILE *file = fopen(checkpoint->path, "rb");
+    if (file == NULL) {
+        if (errno == ENOENT) return 0;
+
+        fprintf(stderr, "failed to open checkpoint %s\n", checkpoint->path);
+        return -1;
+    }
+
+    char                 magic[sizeof(CHECKPOINT_MAGIC)] = {};
+    struct CheckpointKey key                             = {};
+
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+        fread(&key, sizeof(key), 1, file) != 1) {
+        fprintf(stderr, "%s is not a checkpoint\n", checkpoint->path);
+        fclose(file);
+        return -1;
+    }
+
+    /* the keys are zeroed before they are filled, padding included */
+    if (memcmp(&key, &checkpoint->key, sizeof(key)) != 0) {
+        fprintf(stderr, "checkpoint %s belongs to another run\n", checkpoint->path);
+        fclose(file);
+        return -1;
+    }
+
+    size_t n_tasks  = (size_t)key.n_tasks;
+    size_t restored = 0;
+    int    ret      = 0;
+
+    for (size_t w = 0; w < NumWords(checkpoint) && ret == 0; w++) {
+        uint64_t word = 0;
+        if (fread(&word, sizeof(word), 1, file) != 1) ret = -1;
+
+        atomic_store_explicit(&checkpoint->done[w], word, memory_order_relaxed);
+    }
+
+    for (size_t task = 0; task < n_tasks && ret == 0; task++) {
+        if (!CheckpointHasTask(checkpoint, task)) continue;
+
+        uint64_t hits = 0;
+        if (fread(&hits, sizeof(hits), 1, file) != 1) ret = -1;
+
+        task_hits[task] = (size_t)hits;
+        restored++;
+    }
+
+    if (ret != 0) fprintf(stderr, "checkpoint %s is truncated\n", checkpoint->path);
+
+    fclose(file);
+    *n_restored = restored;
+
+    return ret;
+}
+
+struct Checkpoint* OpenCheckpoint(const char *path, double interval, const struct CheckpointKey *key,
+                                  size_t *task_hits, size_t *n_restored) {
+    assert(path);
+    assert(key);
+    assert(task_hits);
+    assert(n_restored);
+
+    size_t n_words  = (size_t)((key->n_tasks + 63) / 64);
+    size_t map_size = sizeof(struct Checkpoint) + n_words * sizeof(uint64_t);
+
+    /* shared and zeroed, so every word of the bitmap starts clear */
+    struct Checkpoint *checkpoint = MapShared(map_size);
+    if (checkpoint == NULL) return NULL;
+
+    checkpoint->path        = path;
+    checkpoint->map_size    = map_size;
+    checkpoint->interval_ns = (interval > 0) ? (uint64_t)(interval * 1e9) : 0;
+    checkpoint->key         = *key;
+    atomic_init(&checkpoint->next_write_ns, GetTimeNs() + checkpoint->interval_ns);
+    atomic_init(&checkpoint->writing, 0);
+
+    *n_restored = 0;
+    if (ReadCheckpoint(checkpoint, task_hits, n_restored) == -1) {
+        UnmapShared(checkpoint, map_size);
+        return NULL;
+    }
+
+    return checkpoint;
+}
+
+void MarkCheckpointTask(struct Checkpoint *checkpoint, const size_t *task_hits, size_t task) {
+    assert(checkpoint);
+
+    /* release: whoever sees the bit sees the hits */
+    atomic_fetch_or_explicit(&checkpoint->done[task / 64], 1ull << (task % 64), memory_order_release);
+
+    uint64_t now = GetTimeNs();
+    if (now < atomic_load_explicit(&checkpoint->next_write_ns, memory_order_relaxed)) return;
+    if (atomic_exchange_explicit(&checkpoint->writing, 1, memory_order_acquire) != 0) return;
+
+    if (now >= atomic_load_explicit(&checkpoint->next_write_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&checkpoint->next_write_ns, now + checkpoint->interval_ns, memory_order_relaxed);
+        WriteCheckpoint(checkpoint, task_hits);
+    }
+
+    atomic_store_explicit(&checkpoint->writing, 0, memory_order_release);
+}
+
+/*
+    a snapshot of the bitmap and the hits of the tasks it marks; the rename
+    replaces the old file at once, a kill in the middle leaves the old one
+*/
+int WriteCheckpoint(struct Checkpoint *checkpoint, const size_t *task_hits) {
+    assert(checkpoint);
+    assert(task_hits);
+
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", checkpoint->path) >= (int)sizeof(tmp_path)) {
+        fprintf(stderr, "checkpoint path %s is too long\n", checkpoint->path);
+        return -1;
+    }
+
+    size_t    n_words  = NumWords(checkpoint);
+    uint64_t *snapshot = malloc(n_words * sizeof(*snapshot) + 1);
+    FILE     *file     = fopen(tmp_path, "wb");
+    if (snapshot == NULL || file == NULL) {
+        fprintf(stderr, "failed to write checkpoint %s\n", tmp_path);
+        free(snapshot);
+        if (file != NULL) fclose(file);
+        return -1;
+    }
+
+    for (size_t w = 0; w < n_words; w++) {
+        snapshot[w] = atomic_load_explicit(&checkpoint->done[w], memory_order_acquire);
+    }
+
+    int ok = (fwrite(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC), 1, file) == 1 &&
+              fwrite(&checkpoint->key, sizeof(checkpoint->key), 1, file) == 1 &&
+              fwrite(snapshot, sizeof(*snapshot), n_words, file) == n_words);
+
+    for (size_t w = 0; w < n_words && ok; w++) {
+        for (uint64_t bits = snapshot[w]; bits != 0 && ok; bits &= bits - 1) {
+            uint64_t hits = task_hits[w * 64 + (size_t)__builtin_ctzll(bits)];
+            ok = (fwrite(&hits, sizeof(hits), 1, file) == 1);
+        }
+    }
+
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(tmp_path, checkpoint->path) == 0;
+
+    free(snapshot);
+
+    if (!ok) {
+        fprintf(stderr, "failed to write checkpoint %s\n", checkpoint->path);
+        remove(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+void CloseCheckpoint(struct Checkpoint *checkpoint) {
+    if (checkpoint != NULL) UnmapShared(checkpoint, checkpoint->map_size);
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+#include "estimators.h"
+
+static const double LAMBDA_UNIFORM = 1e-12;     // flatter exponential proposals are uniform
+
+static const char *ESTIMATOR_NAMES[ESTIMATOR_COUNT] = {
+    "hit", "mean", "antithetic", "control", "importance",
+};
+
+static double PolynomialValue(double x, const void *arg) {
+    const struct PolynomialControl *poly = (const struct PolynomialControl*)arg;
+    double t = (x - poly->center) / poly->scale;
+
+    double value = 0;
+    for (int k = poly->degree; k >= 0; k--) {
+        value = value * t + poly->coef[k];
+    }
+
+    return value;
+}
+
+static double PolynomialAntiderivative(double x, const void *arg) {
+    const struct PolynomialControl *poly = (const struct PolynomialControl*)arg;
+    double t = (x - poly->center) / poly->scale;
+
+    double value = 0;
+    for (int k = poly->degree; k >= 0; k--) {
+        value = value * t + poly->coef[k] / (k + 1);
+    }
+
+    return value * t * poly->scale;
+}
+
+/*
+    interpolation of f at the Chebyshev nodes of [x_min, x_max]: Vandermonde
+    system in t in [-1, 1], solved by Gaussian elimination with partial pivoting
+*/
+int InterpolateControl(const struct Integrand *integrand, double x_min, double x_max,
+                       int degree, struct PolynomialControl *poly) {
+    assert(integrand);
+    assert(poly);
+
+    if (degree < 0 || degree > MAX_CONTROL_DEGREE || !(x_max > x_min)) {
+        fprintf(stderr, "control polynomial degree %d is out of [0, %d]\n", degree, MAX_CONTROL_DEGREE);
+        return -1;
+    }
+
+    int    n = degree + 1;
+    double a[MAX_CONTROL_DEGREE + 1][MAX_CONTROL_DEGREE + 2];
+
+    poly->degree = degree;
+    poly->center = (x_min + x_max) / 2;
+    poly->scale  = (x_max - x_min) / 2;
+
+    for (int i = 0; i < n; i++) {
+        double t = cos(M_PI * (2 * i + 1) / (2 * n));
+
+        a[i][0] = 1;
+        for (int k = 1; k < n; k++) a[i][k] = a[i][k - 1] * t;
+        a[i][n] = integrand->func(poly->center + t * poly->scale);
+    }
+
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) pivot = row;
+        }
+
+        for (int k = 0; k <= n; k++) {
+            double tmp = a[col][k];
+            a[col][k]   = a[pivot][k];
+            a[pivot][k] = tmp;
+        }
+
+        for (int row = col + 1; row < n; row++) {
+            double factor = a[row][col] / a[col][col];
+            for (int k = col; k <= n; k++) a[row][k] -= factor * a[col][k];
+        }
+    }
+
+    for (int row = n - 1; row >= 0; row--) {
+        double value = a[row][n];
+        for (int k = row + 1; k < n; k++) value -= a[row][k] * poly->coef[k];
+        poly->coef[row] = value / a[row][row];
+    }
+
+    return 0;
+}
+
+struct ControlVariate PolynomialControlVariate(const struct PolynomialControl *poly) {
+    struct ControlVariate control = {
+        .func           = PolynomialValue,
+        .antiderivative = PolynomialAntiderivative,
+        .arg            = poly,
+    };
+
+    return control;
+}
+
+static double ExponentialDensity(double x, const void *arg) {
+    const struct ExponentialProposal *p = (const struct ExponentialProposal*)arg;
+
+    if (fabs(p->lambda) < LAMBDA_UNIFORM) return 1 / (p->x_max - p->x_min);
+
+    /* lambda e^(lambda x) / (e^(lambda b) - e^(lambda a)), shifted by a against overflow */
+    return p->lambda * exp(p->lambda * (x - p->x_min)) / expm1(p->lambda * (p->x_max - p->x_min));
+}
+
+static double ExponentialQuantile(double u, const void *arg) {
+    const struct ExponentialProposal *p = (const struct ExponentialProposal*)arg;
+
+    if (fabs(p->lambda) < LAMBDA_UNIFORM) return p->x_min + u * (p->x_max - p->x_min);
+
+    return p->x_min + log1p(u * expm1(p->lambda * (p->x_max - p->x_min))) / p->lambda;
+}
+
+/* e^(lambda x) through the values at the ends, uniform if f vanishes at one of them */
+void FitExponentialProposal(const struct Integrand *integrand, double x_min, double x_max,
+                            struct ExponentialProposal *params) {
+    assert(integrand);
+    assert(params);
+
+    double f_min = integrand->func(x_min);
+    double f_max = integrand->func(x_max);
+
+    params->x_min  = x_min;
+    params->x_max  = x_max;
+    params->lambda = (f_min > 0 && f_max > 0) ? log(f_max / f_min) / (x_max - x_min) : 0;
+}
+
+struct Proposal ExponentialProposalDensity(const struct ExponentialProposal *params) {
+    struct Proposal proposal = {
+        .density    = ExponentialDensity,
+        .quantile   = ExponentialQuantile,
+        .arg        = params,
+    };
+
+    return proposal;
+}
+
+const char* EstimatorName(enum Estimator estimator) {
+    return (estimator >= 0 && estimator < ESTIMATOR_COUNT) ? ESTIMATOR_NAMES[estimator] : "unknown";
+}
+
+int ParseEstimator(const char *name, enum Estimator *estimator) {
+    assert(name);
+    assert(estimator);
+
+    for (int i = 0; i < ESTIMATOR_COUNT; i++) {
+        if (strcmp(ESTIMATOR_NAMES[i], name) == 0) {
+            *estimator = (enum Estimator)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
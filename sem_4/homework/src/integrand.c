@@ -0,0 +1,167 @@
+#include <tgmath.h>
+#include <string.h>
+#include <assert.h>
+
+#include "integrand.h"
+
+DEFINE_INTEGRAND(Exponential,   exp(x))
+DEFINE_INTEGRAND(Polynomial,    1 + x * (1 + x * (-1 + x / 2)))
+DEFINE_INTEGRAND(Sine,          sin(x))
+
+static const struct Integrand INTEGRANDS[] = {
+    { "exp",  ExponentialFunc, ExponentialBatch, 0.0, 1.0,  M_E, 1, ExponentialBatchF },
+    { "poly", PolynomialFunc,  PolynomialBatch,  0.0, 2.0,  3.0, 0, PolynomialBatchF },
+    { "sin",  SineFunc,        SineBatch,        0.0, M_PI, 1.0, 0, SineBatchF },
+};
+
+static void CallbackBatch(const struct Integrand *self, const double *restrict xs,
+                          double *restrict ys, size_t n) {
+    assert(self);
+
+    for (size_t i = 0; i < n; i++) {
+        ys[i] = self->func(xs[i]);
+    }
+}
+
+static void CallbackBatchF(const struct Integrand *self, const float *restrict xs,
+                           float *restrict ys, size_t n) {
+    assert(self);
+
+    for (size_t i = 0; i < n; i++) {
+        ys[i] = (float)self->func(xs[i]);
+    }
+}
+
+const struct Integrand* FindIntegrand(const char *name) {
+    assert(name);
+
+    for (size_t i = 0; i < sizeof(INTEGRANDS) / sizeof(INTEGRANDS[0]); i++) {
+        if (strcmp(INTEGRANDS[i].name, name) == 0) return &INTEGRANDS[i];
+    }
+
+    return NULL;
+}
+
+const struct Integrand* GetIntegrand(size_t index) {
+    if (index >= sizeof(INTEGRANDS) / sizeof(INTEGRANDS[0])) return NULL;
+
+    return &INTEGRANDS[index];
+}
+
+/* any double(double) through the batched interface, one indirect call per sample */
+struct Integrand CallbackIntegrand(const char *name, double (*func)(double),
+                                   double x_min, double x_max, double y_max) {
+    struct Integrand integrand = {
+        .name       = name,
+        .func       = func,
+        .eval       = CallbackBatch,
+        .x_min      = x_min,
+        .x_max      = x_max,
+        .y_max      = y_max,
+        .exp_kernel = 0,
+        .eval_f     = CallbackBatchF,
+    };
+
+    return integrand;
+}
+
+// ============================== n-D ==============================
+
+/* exp(-|x|^2) */
+static void GaussBatch(const struct IntegrandNd *self, int dim, const double *const *xs,
+                       double *restrict ys, size_t n) {
+    (void)self;
+
+    for (size_t i = 0; i < n; i++) ys[i] = 0;
+
+    for (int d = 0; d < dim; d++) {
+        const double *restrict x = xs[d];
+        for (size_t i = 0; i < n; i++) ys[i] += x[i] * x[i];
+    }
+
+    for (size_t i = 0; i < n; i++) ys[i] = exp(-ys[i]);
+}
+
+static double GaussExact(int dim) {
+    return pow(sqrt(M_PI) / 2 * erf(1.0), dim);
+}
+
+/* cos(x_0) * ... * cos(x_{dim-1}) */
+static void CosProductBatch(const struct IntegrandNd *self, int dim, const double *const *xs,
+                            double *restrict ys, size_t n) {
+    (void)self;
+
+    for (size_t i = 0; i < n; i++) ys[i] = 1;
+
+    for (int d = 0; d < dim; d++) {
+        const double *restrict x = xs[d];
+        for (size_t i = 0; i < n; i++) ys[i] *= cos(x[i]);
+    }
+}
+
+static double CosProductExact(int dim) {
+    return pow(sin(1.0), dim);
+}
+
+/* (x_0 + ... + x_{dim-1}) / dim */
+static void MeanCoordBatch(const struct IntegrandNd *self, int dim, const double *const *xs,
+                           double *restrict ys, size_t n) {
+    (void)self;
+
+    for (size_t i = 0; i < n; i++) ys[i] = 0;
+
+    for (int d = 0; d < dim; d++) {
+        const double *restrict x = xs[d];
+        for (size_t i = 0; i < n; i++) ys[i] += x[i];
+    }
+
+    double scale = 1.0 / dim;
+    for (size_t i = 0; i < n; i++) ys[i] *= scale;
+}
+
+static double MeanCoordExact(int dim) {
+    (void)dim;
+    return 0.5;
+}
+
+static const struct IntegrandNd INTEGRANDS_ND[] = {
+    { "gauss",   GaussBatch,      0.0, 1.0, 1.0, GaussExact,      NULL },
+    { "cosprod", CosProductBatch, 0.0, 1.0, 1.0, CosProductExact, NULL },
+    { "mean",    MeanCoordBatch,  0.0, 1.0, 1.0, MeanCoordExact,  NULL },
+};
+
+const struct IntegrandNd* FindIntegrandNd(const char *name) {
+    assert(name);
+
+    for (size_t i = 0; i < sizeof(INTEGRANDS_ND) / sizeof(INTEGRANDS_ND[0]); i++) {
+        if (strcmp(INTEGRANDS_ND[i].name, name) == 0) return &INTEGRANDS_ND[i];
+    }
+
+    return NULL;
+}
+
+static void LiftedBatch(const struct IntegrandNd *self, int dim, const double *const *xs,
+                        double *restrict ys, size_t n) {
+    assert(self);
+    assert(dim == 1);
+    (void)dim;
+
+    self->base->eval(self->base, xs[0], ys, n);
+}
+
+/* a 1-D integrand as an n-D one of dimension 1, for the n-D only modes */
+struct IntegrandNd LiftIntegrand(const struct Integrand *base) {
+    assert(base);
+
+    struct IntegrandNd integrand = {
+        .name   = base->name,
+        .eval   = LiftedBatch,
+        .lo     = base->x_min,
+        .hi     = base->x_max,
+        .y_max  = base->y_max,
+        .exact  = NULL,
+        .base   = base,
+    };
+
+    return integrand;
+}
@@ -1,17 +1,397 @@
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <math.h>
+
 #include "monte_carlo.h"
+#include "result_cache.h"
+
+#define CACHE_ENTRIES 4096              // of a new result cache file
+
+/* 0..MAX_DEPTH, every level multiplies the crossed cells by four */
+static int ParseDepth(const char *text, int *depth) {
+    char *end   = NULL;
+    long  value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 0 || value > MAX_DEPTH) return -1;
+
+    *depth = (int)value;
+    return 0;
+}
+
+/* 1..MAX_DIM, the size of struct Box */
+static int ParseDim(const char *text, int *dim) {
+    char *end   = NULL;
+    long  value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 1 || value > MAX_DIM) return -1;
+
+    *dim = (int)value;
+    return 0;
+}
 
-int main() {
+/*
+    -s <seed>               master seed (default: current time)
+    -r <xoshiro|philox>     random number generator
+    -t <threads>            worker threads (default: grid cells)
+    -B <threads|processes>  backend: worker threads or forked worker processes (default: threads)
+    -P <policy>             worker placement: none, linear, compact, scatter, physical, pcores (default: linear)
+    -f <name>               integrand: exp, poly, sin; with -n: gauss, cosprod, mean (default: exp / gauss)
+    -f <name,name,...>      several integrands from the same points, over the interval of the first
+    -n <dim>                integrate over the dim-dimensional default box of the integrand
+    -m                      mean-value estimator instead of hit-or-miss
+    -E <estimator|all>      hit, mean, antithetic, control (quadratic interpolant of f),
+                            importance (density ~ e^(lambda x) through the ends of f); all - compare them
+    -q <sobol|halton>       quasi-random points (n-D, the 1-D integrands are lifted to it)
+    -R <replicas>           QMC: randomly shifted replicas for the error estimate (default: 16)
+    -a                      adaptive: pilot pass + Neyman allocation of the rest
+    -d <depth>              adaptive: refine the cells crossed by the curve this many times (0..16)
+    -e <error>              adaptive: stop at this standard error
+    -N <points>             point budget (default: 10M)
+    -p                      progressive: print the running estimate, stop early on -T / -D
+    -T <tolerance>          progressive: half width of the 95% confidence interval to stop at
+    -D <seconds>            progressive: deadline
+    -F                      float32 sampling, the double run on the same seed gives the bias
+    -c <file>               checkpoint: save the finished tasks, resume from the file if it exists
+    -i <seconds>            checkpoint interval (default: 60)
+    -K <file>               result cache: reuse the estimate of an earlier run, add points to reach -N or -e
+*/
+static int ParseArgs(int argc, char *argv[], struct IntegralConfig *config,
+                     const char **integrand, int *dim, int *compare, const char **cache) {
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "s:r:t:B:P:f:n:mE:q:R:ad:e:N:pT:D:Fc:i:K:")) != -1) {
+        switch (opt) {
+            case 's':
+                config->seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'r':
+                if (strcmp(optarg, "xoshiro") == 0) {
+                    config->rng = RNG_XOSHIRO;
+                } else if (strcmp(optarg, "philox") == 0) {
+                    config->rng = RNG_PHILOX;
+                } else {
+                    fprintf(stderr, "unknown rng '%s', use xoshiro or philox\n", optarg);
+                    return -1;
+                }
+                break;
+            case 't':
+                config->num_threads = atoi(optarg);
+                break;
+            case 'B':
+                if (ParseBackend(optarg, &config->backend) == -1) {
+                    fprintf(stderr, "unknown backend '%s', use threads or processes\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'P':
+                if (ParsePlacement(optarg, &config->placement) == -1) {
+                    fprintf(stderr, "unknown placement '%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'f':
+                *integrand = optarg;
+                break;
+            case 'n':
+                if (ParseDim(optarg, dim) == -1) {
+                    fprintf(stderr, "dimension must be an integer from 1 to %d\n", MAX_DIM);
+                    return -1;
+                }
+                break;
+            case 'm':
+                config->estimator = ESTIMATOR_MEAN_VALUE;
+                break;
+            case 'E':
+                if (strcmp(optarg, "all") == 0) {
+                    *compare = 1;
+                } else if (ParseEstimator(optarg, &config->estimator) == -1) {
+                    fprintf(stderr, "unknown estimator '%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'q':
+                if (strcmp(optarg, "sobol") == 0) {
+                    config->sequence = SEQ_SOBOL;
+                } else if (strcmp(optarg, "halton") == 0) {
+                    config->sequence = SEQ_HALTON;
+                } else {
+                    fprintf(stderr, "unknown sequence '%s', use sobol or halton\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'R':
+                config->replicas = atoi(optarg);
+                break;
+            case 'a':
+                config->adaptive = 1;
+                break;
+            case 'd':
+                if (ParseDepth(optarg, &config->max_depth) == -1) {
+                    fprintf(stderr, "depth must be an integer from 0 to %d\n", MAX_DEPTH);
+                    return -1;
+                }
+                break;
+            case 'e':
+                config->target_error = strtod(optarg, NULL);
+                break;
+            case 'N':
+                config->max_points = strtoull(optarg, NULL, 0);
+                break;
+            case 'p':
+                config->progressive = 1;
+                break;
+            case 'T':
+                config->tolerance = strtod(optarg, NULL);
+                break;
+            case 'D':
+                config->deadline = strtod(optarg, NULL);
+                break;
+            case 'F':
+                config->precision = PRECISION_FLOAT;
+                break;
+            case 'c':
+                config->checkpoint = optarg;
+                break;
+            case 'i':
+                config->checkpoint_interval = strtod(optarg, NULL);
+                break;
+            case 'K':
+                *cache = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s seed] [-r xoshiro|philox] [-t threads] [-B backend] [-P placement] [-f integrand] [-n dim] [-m] [-E estimator] [-q sobol|halton] [-R replicas] [-a] [-d depth] [-e error] [-N points] [-p] [-T tolerance] [-D seconds] [-F] [-c file] [-i seconds] [-K file]\n",
+                        argv[0]);
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    "exp,poly,sin": all of them on the points of one run, the area is the interval
+    of the first and the largest bound, the differences from the first are printed with their errors
+*/
+static int RunMulti(const char *names, int num_cells_sqrt, const struct IntegralConfig *config) {
+    const struct Integrand *integrands[MAX_INTEGRANDS] = {};
+    size_t                  n_integrands               = 0;
+
+    char buffer[256] = {};
+    strncpy(buffer, names, sizeof(buffer) - 1);
+
+    for (char *save = NULL, *name = strtok_r(buffer, ",", &save); name != NULL;
+         name = strtok_r(NULL, ",", &save)) {
+        if (n_integrands == MAX_INTEGRANDS || (integrands[n_integrands] = FindIntegrand(name)) == NULL) {
+            fprintf(stderr, "unknown integrand '%s' or more than %d of them\n", name, MAX_INTEGRANDS);
+            return -1;
+        }
+        n_integrands++;
+    }
+
+    double y_max = 0;
+    for (size_t k = 0; k < n_integrands; k++) {
+        if (integrands[k]->y_max > y_max) y_max = integrands[k]->y_max;
+    }
+
+    struct MultiIntegralResult result = CalculateMultiIntegral(integrands, n_integrands, num_cells_sqrt,
+                                                               integrands[0]->x_min, integrands[0]->x_max,
+                                                               0.0, y_max, config);
+    if (result.values == NULL) return -1;
+
+    printf("Time duration: %lg\n", result.seconds);
+    printf("Points: %zu, strata: %zu\n", result.points, result.n_strata);
+
+    for (size_t k = 0; k < result.n_integrands; k++) {
+        size_t n = result.n_integrands;
+        printf("  %-6s %.10lg +- %.3lg", integrands[k]->name, result.values[k], sqrt(result.covariance[k * n + k]));
+        if (k > 0) {
+            printf(", - %s = %.10lg +- %.3lg", integrands[0]->name, result.values[k] - result.values[0],
+                   DifferenceError(&result, k, 0));
+        }
+        printf("\n");
+    }
+
+    FreeMultiIntegralResult(&result);
+
+    return 0;
+}
+
+/* every estimator on the same budget; variance x points is the cost of a given error */
+static void CompareEstimators(const struct Integrand *integrand, int num_cells_sqrt, struct IntegralConfig config) {
+    printf("%-12s %-18s %-10s %-14s %s\n", "estimator", "value", "std error", "var x points", "seconds");
+
+    for (int e = 0; e < ESTIMATOR_COUNT; e++) {
+        config.estimator = (enum Estimator)e;
+
+        struct IntegralResult result = CalculateIntegral(integrand, num_cells_sqrt,
+                                                         integrand->x_min, integrand->x_max,
+                                                         0.0, integrand->y_max, &config);
+
+        printf("%-12s %-18.12lg %-10.3lg %-14.4lg %.4lf\n", EstimatorName(config.estimator), result.value,
+               result.std_error, result.variance * (double)result.points, result.seconds);
+        FreeIntegralResult(&result);
+    }
+}
+
+/* at most ten lines a second */
+static void PrintProgress(const struct IntegralProgress *progress, void *arg) {
+    double *last_print = (double*)arg;
+    if (progress->seconds - *last_print < 0.1) return;
+
+    *last_print = progress->seconds;
+    printf("  %.3lf s: %.10lg +- %.3lg (%zu points)\n",
+           progress->seconds, progress->value, progress->half_width, progress->points);
+}
+
+int main(int argc, char *argv[]) {
     int num_threads_sqrt = 2;
 
+    struct IntegralConfig   config          = DefaultIntegralConfig();
+    const char             *integrand_name  = NULL;
+    int                     dim             = 0;
+    int                     compare         = 0;
+    const char             *cache_path      = NULL;
+    if (ParseArgs(argc, argv, &config, &integrand_name, &dim, &compare, &cache_path) == -1) {
+        return 1;
+    }
+
+    const struct Integrand   *integrand    = NULL;
+    const struct IntegrandNd *integrand_nd = NULL;
+    int                       multi        = (dim == 0 && integrand_name != NULL &&
+                                              strchr(integrand_name, ',') != NULL);
+    if (multi) {
+        /* checked by RunMulti() */
+    } else if (dim > 0) {
+        integrand_nd = FindIntegrandNd(integrand_name ? integrand_name : "gauss");
+    } else {
+        integrand    = FindIntegrand(integrand_name ? integrand_name : "exp");
+    }
+
+    if (!multi && integrand == NULL && integrand_nd == NULL) {
+        fprintf(stderr, "unknown integrand '%s'\n", integrand_name);
+        return 1;
+    }
+
     printf("Enter the root of the number of threads on which the program will run: ");
     if (scanf("%d", &num_threads_sqrt) != 1) {
         fprintf(stderr, "failed to get num treads sqrt, pls enter number\n");
         return 1;
     }
 
-    double result = CalculateIntegral(ExponentialFunc, num_threads_sqrt, 0.0, 1.0, 0.0, ExponentialFunc(1.0));
+    /* the grid no longer dictates the thread count, keep the old default */
+    if (config.num_threads <= 0) {
+        config.num_threads = num_threads_sqrt * num_threads_sqrt;
+    }
 
-    printf("Result: %lg\n", result);
+    printf("Seed: %" PRIu64 " (%s), %s: %d (%s), integrand: %s, estimator: %s, %s\n",
+           config.seed, RngName(config.rng), BackendName(config.backend), config.num_threads,
+           PlacementName(config.placement),
+           multi ? integrand_name : integrand ? integrand->name : integrand_nd->name,
+           EstimatorName(config.estimator), (config.precision == PRECISION_FLOAT) ? "float32" : "float64");
 
-    return 0;
+    if (multi) {
+        return (RunMulti(integrand_name, num_threads_sqrt, &config) == 0) ? 0 : 1;
+    }
+
+    struct IntegralResult result = {};
+    struct IntegrandNd    lifted = {};
+
+    /* stand-ins for the user-supplied approximations of the 1-D integrand */
+    struct PolynomialControl   poly     = {};
+    struct ExponentialProposal tilt     = {};
+    struct ControlVariate      control  = {};
+    struct Proposal            proposal = {};
+    if (integrand != NULL && InterpolateControl(integrand, integrand->x_min, integrand->x_max, 2, &poly) == 0) {
+        FitExponentialProposal(integrand, integrand->x_min, integrand->x_max, &tilt);
+
+        control         = PolynomialControlVariate(&poly);
+        proposal        = ExponentialProposalDensity(&tilt);
+        config.control  = &control;
+        config.proposal = &proposal;
+    }
+
+    if (compare && integrand != NULL && config.sequence == SEQ_PSEUDO) {
+        CompareEstimators(integrand, num_threads_sqrt, config);
+        return 0;
+    }
+
+    double last_print = 0;
+    if (config.progressive) {
+        config.on_progress  = PrintProgress;
+        config.progress_arg = &last_print;
+    }
+
+    /* QMC lives in the n-D integrator */
+    if (integrand != NULL && config.sequence != SEQ_PSEUDO) {
+        lifted       = LiftIntegrand(integrand);
+        integrand_nd = &lifted;
+        dim          = 1;
+    }
+
+    if (config.sequence != SEQ_PSEUDO) {
+        printf("Sequence: %s, replicas: %d\n", SequenceName(config.sequence), config.replicas);
+    }
+
+    if (integrand_nd != NULL) {
+        struct Box box = { .dim = dim };
+        for (int d = 0; d < dim && d < MAX_DIM; d++) {
+            box.lo[d] = integrand_nd->lo;
+            box.hi[d] = integrand_nd->hi;
+        }
+
+        result = CalculateIntegralNd(integrand_nd, &box, &config);
+        if (integrand_nd->exact != NULL) {
+            printf("Exact: %.10lg\n", integrand_nd->exact(dim));
+        }
+    } else if (cache_path != NULL) {
+        struct ResultCache *cache = OpenResultCache(cache_path, CACHE_ENTRIES);
+        if (cache == NULL) return 1;
+
+        result = CachedIntegral(cache, integrand, num_threads_sqrt,
+                                integrand->x_min, integrand->x_max, 0.0, integrand->y_max, &config);
+        CloseResultCache(cache);
+    } else {
+        result = CalculateIntegral(integrand, num_threads_sqrt,
+                                   integrand->x_min, integrand->x_max, 0.0, integrand->y_max, &config);
+    }
+
+    printf("Time duration: %lg\n", result.seconds);
+    printf("Points: %zu, strata: %zu, standard error: %lg%s\n", result.points, result.n_strata, result.std_error,
+           result.stopped ? " (stopped early)" : "");
+    if (result.resumed_points > 0) {
+        printf("Resumed: %zu points from %s\n", result.resumed_points, config.checkpoint);
+    }
+    if (cache_path != NULL && result.points > 0) {
+        printf("Cached: %zu points from %s, %zu sampled now\n", result.cached_points, cache_path,
+               result.points - result.cached_points);
+    }
+
+    for (int i = 0; i < result.n_threads; i++) {
+        const struct ThreadStats *stats = &result.threads[i];
+        printf("  thread %2d: tasks %4zu, points %9zu, busy %.4lf s, task estimate variance %.3le\n",
+               i, stats->tasks, stats->points, stats->seconds, stats->variance);
+    }
+
+    printf("Result: %.10lg\n", result.value);
+
+    /* the same seed draws the same words, so the difference is the float32 bias, not noise */
+    if (config.precision == PRECISION_FLOAT && integrand != NULL && integrand_nd == NULL) {
+        config.precision   = PRECISION_DOUBLE;
+        config.on_progress = NULL;
+        config.checkpoint  = NULL;
+
+        struct IntegralResult reference = CalculateIntegral(integrand, num_threads_sqrt, integrand->x_min,
+                                                            integrand->x_max, 0.0, integrand->y_max, &config);
+        double bias = result.value - reference.value;
+
+        printf("Float64: %.10lg in %lg s, float32 bias %.3lg (%.3lg standard errors)\n",
+               reference.value, reference.seconds, bias,
+               (reference.std_error > 0) ? bias / reference.std_error : 0.0);
+        FreeIntegralResult(&reference);
+    }
+
+    /* the integrator has already said why */
+    int status = (result.points > 0) ? 0 : 1;
+
+    FreeIntegralResult(&result);
+
+    return status;
 }
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "process_pool.h"
+
+_Static_assert(ATOMIC_LONG_LOCK_FREE == 2, "the queue needs address-free atomics");
+
+void* MapShared(size_t size) {
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "failed to map %zu bytes of shared memory\n", size);
+        return NULL;
+    }
+
+    return addr;
+}
+
+void UnmapShared(void *addr, size_t size) {
+    if (addr != NULL) munmap(addr, size);
+}
+
+/* body of a forked worker, never returns */
+static void ProcessWorkerMain(struct ProcessQueue *queue, const struct PoolJob *job, int index, int cpu) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET((size_t)cpu, &cpuset);
+        sched_setaffinity(0, sizeof(cpuset), &cpuset);
+    }
+
+    for (;;) {
+        size_t task = atomic_fetch_add_explicit(&queue->next, 1, memory_order_relaxed);
+        if (task >= queue->n_tasks) break;
+
+        job->run(job->ctx, task, index);
+        atomic_fetch_add_explicit(&queue->done, 1, memory_order_release);
+    }
+
+    /* no atexit handlers, no flush of the stdio buffers inherited from the parent */
+    _exit(0);
+}
+
+int RunProcessJob(int n_workers, enum PlacementPolicy placement, const struct PoolJob *job) {
+    assert(job);
+
+    if (n_workers <= 0) n_workers = GetNumCores();
+
+    int   *cpus = calloc((size_t)(n_workers > CPU_SETSIZE ? n_workers : CPU_SETSIZE), sizeof(*cpus));
+    pid_t *pids = calloc((size_t)n_workers, sizeof(*pids));
+    struct ProcessQueue *queue = MapShared(sizeof(*queue));
+    if (cpus == NULL || pids == NULL || queue == NULL) {
+        fprintf(stderr, "failed to allocate memory for workers\n");
+        free(cpus);
+        free(pids);
+        UnmapShared(queue, sizeof(*queue));
+        return -1;
+    }
+
+    atomic_init(&queue->next, 0);
+    atomic_init(&queue->done, 0);
+    queue->n_tasks = job->n_tasks;
+
+    /* same placement as the thread pool, more workers than CPUs wrap around */
+    int n_cpus = PlacementOrder(placement, cpus, CPU_SETSIZE);
+    for (int i = n_workers - 1; i >= 0; i--) {
+        cpus[i] = (n_cpus > 0) ? cpus[i % n_cpus] : -1;
+    }
+
+    /* an integrand that calls exit() in a child would write the buffered output of the parent once more */
+    fflush(NULL);
+
+    int created = 0;
+    for (; created < n_workers; created++) {
+        pids[created] = fork();
+        if (pids[created] == 0) {
+            ProcessWorkerMain(queue, job, created, cpus[created]);
+        }
+        if (pids[created] < 0) break;
+    }
+
+    if (created < n_workers) {
+        fprintf(stderr, "failed to fork worker %d, running with %d\n", created, created);
+    }
+
+    int ret = (created > 0) ? 0 : -1;
+    for (int i = 0; i < created; i++) {
+        int status = 0;
+        if (waitpid(pids[i], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "worker process %d failed\n", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && atomic_load_explicit(&queue->done, memory_order_acquire) != job->n_tasks) {
+        fprintf(stderr, "failed to run every task of the job\n");
+        ret = -1;
+    }
+
+    UnmapShared(queue, sizeof(*queue));
+    free(pids);
+    free(cpus);
+
+    return ret;
+}
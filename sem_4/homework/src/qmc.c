@@ -0,0 +1,234 @@
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "qmc.h"
+
+/* primitive polynomial degree s, its inner coefficients a and the initial m_1..m_s (new-joe-kuo-6.21201) */
+static const struct {
+    int         s;
+    unsigned    a;
+    uint32_t    m[8];
+} JOE_KUO[SOBOL_MAX_DIM - 1] = {
+    {1,  0, {1}},
+    {2,  1, {1, 3}},
+    {3,  1, {1, 3, 1}},
+    {3,  2, {1, 1, 1}},
+    {4,  1, {1, 1, 3, 3}},
+    {4,  4, {1, 3, 5, 13}},
+    {5,  2, {1, 1, 5, 5, 17}},
+    {5,  4, {1, 1, 5, 5, 5}},
+    {5,  7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6,  1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},
+    {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7,  1, {1, 3, 7, 11, 23, 15, 103}},
+    {7,  4, {1, 3, 7, 13, 13, 15, 69}},
+};
+
+static const uint32_t PRIMES[HALTON_MAX_DIM] = {
+      2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,  59,
+     61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131, 137,
+};
+
+/* filled once, read only afterwards */
+static uint32_t         SOBOL_V[SOBOL_MAX_DIM][SOBOL_BITS];
+static pthread_once_t   SOBOL_ONCE = PTHREAD_ONCE_INIT;
+
+static void InitSobolDirections(void) {
+    for (int k = 0; k < SOBOL_BITS; k++) {
+        SOBOL_V[0][k] = 1u << (SOBOL_BITS - 1 - k);
+    }
+
+    for (int d = 1; d < SOBOL_MAX_DIM; d++) {
+        int         s = JOE_KUO[d - 1].s;
+        unsigned    a = JOE_KUO[d - 1].a;
+        uint32_t   *v = SOBOL_V[d];
+
+        for (int k = 0; k < s; k++) {
+            v[k] = JOE_KUO[d - 1].m[k] << (SOBOL_BITS - 1 - k);
+        }
+
+        for (int k = s; k < SOBOL_BITS; k++) {
+            v[k] = v[k - s] ^ (v[k - s] >> s);
+            for (int l = 1; l < s; l++) {
+                if ((a >> (s - 1 - l)) & 1) v[k] ^= v[k - l];
+            }
+        }
+    }
+}
+
+/*
+    halton values are kept as integers: the digits k < K of the mirrored index
+    weigh p^(K-1-k), p^K is the largest power of p in 64 bits. The point is the
+    integer times 1/p^K, so no rounding accumulates as the index grows; digits
+    from K on are below the resolution of a double anyway
+*/
+struct HaltonBase {
+    int         n_digits;                   // K
+    uint64_t    weight[64];                 // p^(K-1-k)
+    double      scale;                      // 1 / p^K
+};
+
+static struct HaltonBase HALTON_BASES[HALTON_MAX_DIM];
+static pthread_once_t    HALTON_ONCE = PTHREAD_ONCE_INIT;
+
+static void InitHaltonBases(void) {
+    for (int d = 0; d < HALTON_MAX_DIM; d++) {
+        struct HaltonBase *base = &HALTON_BASES[d];
+
+        uint64_t power = 1;
+        int      k     = 0;
+        while (power <= UINT64_MAX / PRIMES[d]) {
+            power *= PRIMES[d];
+            k++;
+        }
+
+        base->n_digits = k;
+        base->scale    = 1.0 / (double)power;
+
+        uint64_t weight = 1;
+        for (int i = k - 1; i >= 0; i--) {
+            base->weight[i] = weight;
+            weight *= PRIMES[d];
+        }
+    }
+}
+
+/*
+    random lower triangular matrix with a unit diagonal over GF(2): output bit b
+    is the parity of bit b and random higher (more significant) bits of the input.
+    Scrambling the direction numbers scrambles every point, x is their xor
+*/
+static void ScrambleDirections(uint32_t *direction, const uint32_t *v, Rng *rng) {
+    uint32_t rows[SOBOL_BITS];
+    for (int b = 0; b < SOBOL_BITS; b++) {
+        uint32_t above = (b == SOBOL_BITS - 1) ? 0 : ~((2u << b) - 1);
+        rows[b] = (1u << b) | ((uint32_t)(RngNext(rng) >> 32) & above);
+    }
+
+    for (int k = 0; k < SOBOL_BITS; k++) {
+        uint32_t scrambled = 0;
+        for (int b = 0; b < SOBOL_BITS; b++) {
+            scrambled |= (uint32_t)(__builtin_popcount(rows[b] & v[k]) & 1) << b;
+        }
+        direction[k] = scrambled;
+    }
+}
+
+int QmcMaxDim(enum Sequence kind) {
+    switch (kind) {
+        case SEQ_SOBOL:     return SOBOL_MAX_DIM;
+        case SEQ_HALTON:    return HALTON_MAX_DIM;
+        case SEQ_PSEUDO:    return 0;
+        default:            return 0;
+    }
+}
+
+/* cursor at the index-th point of the given replica */
+int QmcInit(struct QmcCursor *cursor, enum Sequence kind, int dim,
+            uint64_t seed, uint64_t replica, uint64_t index) {
+    assert(cursor);
+
+    if (dim < 1 || dim > QmcMaxDim(kind)) {
+        fprintf(stderr, "%s supports dimensions 1..%d, got %d\n", SequenceName(kind), QmcMaxDim(kind), dim);
+        return -1;
+    }
+
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->kind  = kind;
+    cursor->dim   = dim;
+    cursor->index = index;
+
+    /* the shifts of a replica come from its own stream, whoever generates it */
+    Rng rng = {};
+    RngInit(&rng, RNG_XOSHIRO, seed, replica);
+
+    if (kind == SEQ_SOBOL) {
+        pthread_once(&SOBOL_ONCE, InitSobolDirections);
+
+        uint64_t gray = index ^ (index >> 1);
+        for (int d = 0; d < dim; d++) {
+            ScrambleDirections(cursor->direction[d], SOBOL_V[d], &rng);
+            cursor->digital_shift[d] = (uint32_t)(RngNext(&rng) >> 32);
+
+            for (int k = 0; k < SOBOL_BITS && (gray >> k) != 0; k++) {
+                if ((gray >> k) & 1) cursor->x[d] ^= cursor->direction[d][k];
+            }
+        }
+    } else {
+        pthread_once(&HALTON_ONCE, InitHaltonBases);
+
+        for (int d = 0; d < dim; d++) {
+            const struct HaltonBase *base = &HALTON_BASES[d];
+
+            cursor->rotation[d] = RngUniform(&rng);
+
+            uint64_t rest = index;
+            for (int k = 0; rest > 0; k++) {
+                cursor->digits[d][k] = (uint8_t)(rest % PRIMES[d]);
+                rest /= PRIMES[d];
+
+                if (k < base->n_digits) cursor->radical[d] += cursor->digits[d][k] * base->weight[k];
+            }
+        }
+    }
+
+    return 0;
+}
+
+void QmcNext(struct QmcCursor *cursor, double *point) {
+    assert(cursor);
+    assert(point);
+
+    if (cursor->kind == SEQ_SOBOL) {
+        for (int d = 0; d < cursor->dim; d++) {
+            point[d] = (double)(cursor->x[d] ^ cursor->digital_shift[d]) * 0x1.0p-32;
+        }
+
+        /* Gray code: the next point differs by the direction number of the lowest zero bit */
+        int bit = __builtin_ctzll(~cursor->index);
+        for (int d = 0; d < cursor->dim && bit < SOBOL_BITS; d++) {
+            cursor->x[d] ^= cursor->direction[d][bit];
+        }
+    } else {
+        for (int d = 0; d < cursor->dim; d++) {
+            const struct HaltonBase *base = &HALTON_BASES[d];
+
+            double u = (double)cursor->radical[d] * base->scale + cursor->rotation[d];
+            point[d] = (u >= 1) ? u - 1 : u;
+
+            /* index + 1 in base p: carried digits drop out of the mirrored value, the next one comes in */
+            uint32_t p = PRIMES[d];
+            int      k = 0;
+
+            while (cursor->digits[d][k] == p - 1) {
+                cursor->digits[d][k] = 0;
+                if (k < base->n_digits) cursor->radical[d] -= (p - 1) * base->weight[k];
+                k++;
+            }
+
+            cursor->digits[d][k]++;
+            if (k < base->n_digits) cursor->radical[d] += base->weight[k];
+        }
+    }
+
+    cursor->index++;
+}
+
+const char* SequenceName(enum Sequence kind) {
+    switch (kind) {
+        case SEQ_PSEUDO:    return "pseudo-random";
+        case SEQ_SOBOL:     return "sobol";
+        case SEQ_HALTON:    return "halton";
+        default:            return "unknown";
+    }
+}
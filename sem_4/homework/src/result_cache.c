@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "result_cache.h"
+
+static const char RESULT_CACHE_MAGIC[8] = "MCCACH2";
+
+static const int    MAX_REFINEMENTS = 3;     // runs of one call with a target error (the variance is an estimate)
+static const double PILOT_SHARE     = 0.1;   // of the budget spent first when there is no variance yet
+
+static uint64_t                 HashKey     (const struct ResultCacheKey *key);
+static struct ResultCacheEntry* FindEntry   (struct ResultCache *cache, const struct ResultCacheKey *key);
+static size_t                   NeededPoints(const struct ResultCacheEntry *entry, size_t budget,
+                                             double target_error);
+
+/* FNV-1a over the bytes of the zeroed key */
+static uint64_t HashKey(const struct ResultCacheKey *key) {
+    const unsigned char *bytes = (const unsigned char*)key;
+    uint64_t             hash  = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < sizeof(*key); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+/* linear probing: the entry of the key or the free slot it goes to, NULL if the table is full */
+static struct ResultCacheEntry* FindEntry(struct ResultCache *cache, const struct ResultCacheKey *key) {
+    size_t capacity = (size_t)cache->header->capacity;
+    size_t start    = (size_t)(HashKey(key) % capacity);
+
+    for (size_t i = 0; i < capacity; i++) {
+        struct ResultCacheEntry *entry = &cache->entries[(start + i) % capacity];
+        if (!entry->used || memcmp(&entry->key, key, sizeof(*key)) == 0) return entry;
+    }
+
+    return NULL;
+}
+
+/* points the entry should have: the budget, or fewer if the error scaled as 1/sqrt(n) meets the target */
+static size_t NeededPoints(const struct ResultCacheEntry *entry, size_t budget, double target_error) {
+    if (target_error <= 0) return budget;
+
+    if (entry->points == 0) return (size_t)((double)budget * PILOT_SHARE);
+    if (entry->variance <= target_error * target_error) return (size_t)entry->points;
+
+    double needed = ceil((double)entry->points * entry->variance / (target_error * target_error));
+
+    return (needed < (double)budget) ? (size_t)needed : budget;
+}
+
+struct ResultCache* OpenResultCache(const char *path, size_t capacity) {
+    assert(path);
+
+    if (capacity == 0) {
+        fprintf(stderr, "result cache needs a positive capacity\n");
+        return NULL;
+    }
+
+    struct ResultCache *cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        fprintf(stderr, "failed to allocate memory for result cache\n");
+        return NULL;
+    }
+
+    cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (cache->fd == -1 || flock(cache->fd, LOCK_EX) == -1) {
+        fprintf(stderr, "failed to open result cache %s\n", path);
+        if (cache->fd != -1) close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+
+    /* the size of a new file follows from the capacity, of an existing one from its header */
+    struct stat st = {};
+    int         created = (fstat(cache->fd, &st) == 0 && st.st_size == 0);
+    int         ok      = (st.st_size > 0 || created);
+
+    if (created) {
+        cache->map_size = sizeof(struct ResultCacheHeader) + capacity * sizeof(struct ResultCacheEntry);
+        ok = (ftruncate(cache->fd, (off_t)cache->map_size) == 0);
+    } else {
+        cache->map_size = (size_t)st.st_size;
+    }
+
+    if (ok && cache->map_size < sizeof(struct ResultCacheHeader)) {
+        fprintf(stderr, "%s is not a result cache\n", path);
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+
+    void *addr = ok ? mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0) : MAP_FAILED;
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "failed to map result cache %s\n", path);
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+
+    cache->header  = (struct ResultCacheHeader*)addr;
+    cache->entries = (struct ResultCacheEntry*)(cache->header + 1);
+
+    if (created) {
+        memcpy(cache->header->magic, RESULT_CACHE_MAGIC, sizeof(RESULT_CACHE_MAGIC));
+        cache->header->entry_size = sizeof(struct ResultCacheEntry);
+        cache->header->capacity   = capacity;
+        cache->header->count      = 0;
+    }
+
+    if (memcmp(cache->header->magic, RESULT_CACHE_MAGIC, sizeof(RESULT_CACHE_MAGIC)) != 0 ||
+        cache->header->entry_size != sizeof(struct ResultCacheEntry) || cache->header->capacity == 0 ||
+        cache->map_size != sizeof(struct ResultCacheHeader) +
+                           (size_t)cache->header->capacity * sizeof(struct ResultCacheEntry)) {
+        fprintf(stderr, "%s is not a result cache\n", path);
+        munmap(addr, cache->map_size);
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+void CloseResultCache(struct ResultCache *cache) {
+    if (cache == NULL) return;
+
+    msync(cache->header, cache->map_size, MS_SYNC);
+    munmap(cache->header, cache->map_size);
+    close(cache->fd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/*
+    two runs with n1 and n2 points on disjoint streams are independent estimates,
+    (n1 v1 + n2 v2) / (n1 + n2) has the variance (n1^2 var1 + n2^2 var2) / (n1 + n2)^2.
+    In the uniform mode every stratum gets the same share of both runs, so this is
+    exactly the estimate of one run with all the points
+*/
+struct IntegralResult CachedIntegral(struct ResultCache *cache, const struct Integrand *integrand,
+                                     int num_cells_sqrt, double x_min, double x_max,
+                                     double y_min, double y_max, const struct IntegralConfig *config) {
+    assert(cache);
+    assert(integrand);
+
+    struct IntegralConfig defaults = DefaultIntegralConfig();
+    if (config == NULL) config = &defaults;
+
+    struct IntegralResult result = { .value = NAN };
+
+    if (config->adaptive || config->progressive || config->checkpoint != NULL || config->stream_offset != 0 ||
+        num_cells_sqrt < 1 ||
+        (config->estimator != ESTIMATOR_HIT_OR_MISS && config->estimator != ESTIMATOR_MEAN_VALUE &&
+         config->estimator != ESTIMATOR_ANTITHETIC)) {
+        fprintf(stderr, "the result cache supports the uniform mode of the hit, mean and antithetic estimators\n");
+        return result;
+    }
+
+    struct ResultCacheKey key;
+    memset(&key, 0, sizeof(key));
+
+    memcpy(key.integrand, integrand->name, strnlen(integrand->name, RESULT_CACHE_NAME_LEN - 1));
+    key.seed            = config->seed;
+    key.rng             = (uint32_t)config->rng;
+    key.sampler         = SamplerId(integrand, config);
+    key.estimator       = (uint32_t)config->estimator;
+    key.precision       = (uint32_t)config->precision;
+    key.num_cells_sqrt  = num_cells_sqrt;
+    key.x_min           = x_min;
+    key.x_max           = x_max;
+    key.y_min           = y_min;
+    key.y_max           = y_max;
+
+    uint64_t start     = GetTimeNs();
+    size_t   budget    = (config->max_points > 0) ? config->max_points : TOTAL_POINTS;
+    size_t   num_cells = (size_t)num_cells_sqrt * (size_t)num_cells_sqrt;
+
+    pthread_mutex_lock(&cache->lock);
+    flock(cache->fd, LOCK_EX);
+
+    struct ResultCacheEntry *slot  = FindEntry(cache, &key);
+    struct ResultCacheEntry  entry = (slot != NULL && slot->used) ? *slot : (struct ResultCacheEntry){ .key = key };
+
+    size_t cached = (size_t)entry.points;
+    int    failed = 0;
+
+    for (int run = 0; run < MAX_REFINEMENTS && !failed; run++) {
+        size_t needed = NeededPoints(&entry, budget, config->target_error);
+        if (needed <= entry.points) break;
+
+        /* whole points (pairs) per stratum, at least two, from the first stream no run of the entry took */
+        size_t unit    = num_cells * ((config->estimator == ESTIMATOR_ANTITHETIC) ? 2 : 1);
+        size_t missing = (needed - (size_t)entry.points + unit - 1) / unit * unit;
+
+        struct IntegralConfig refine = *config;
+        refine.max_points    = (missing > 2 * unit) ? missing : 2 * unit;
+        refine.stream_offset = entry.streams;
+        refine.target_error  = 0;
+
+        struct IntegralResult extra = CalculateIntegral(integrand, num_cells_sqrt, x_min, x_max,
+                                                        y_min, y_max, &refine);
+        if (extra.points == 0 || isnan(extra.value)) {
+            FreeIntegralResult(&extra);
+            failed = 1;
+            break;
+        }
+
+        double n1 = (double)entry.points, n2 = (double)extra.points, n = n1 + n2;
+
+        entry.value    = (n1 * entry.value + n2 * extra.value) / n;
+        entry.variance = (n1 * n1 * entry.variance + n2 * n2 * extra.variance) / (n * n);
+        entry.points  += extra.points;
+        entry.streams += extra.streams;
+
+        /* the stats of the workers are those of the last run */
+        FreeIntegralResult(&result);
+        result.n_threads = extra.n_threads;
+        result.threads   = extra.threads;
+    }
+
+    if (!failed && entry.points > cached) {
+        if (slot == NULL) {
+            fprintf(stderr, "result cache is full, the estimate is not saved\n");
+        } else {
+            if (!slot->used) cache->header->count++;
+
+            entry.used = 1;
+            *slot      = entry;
+            msync(cache->header, cache->map_size, MS_SYNC);
+        }
+    }
+
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_unlock(&cache->lock);
+
+    if (!failed && entry.points > 0) {
+        result.value         = entry.value;
+        result.variance      = entry.variance;
+        result.std_error     = sqrt(entry.variance);
+        result.points        = (size_t)entry.points;
+        result.n_strata      = num_cells;
+        result.streams       = entry.streams;
+        result.cached_points = cached;
+    } else {
+        fprintf(stderr, "failed to run integration\n");
+    }
+
+    result.seconds = (double)(GetTimeNs() - start) / 1e9;
+
+    return result;
+}
@@ -0,0 +1,121 @@
+#include <assert.h>
+#include <string.h>
+
+#include "rng.h"
+#include "simd_kernel.h"
+
+static const uint64_t STREAM_STEP = 0xD1B54A32D192ED03ull;
+
+uint64_t SplitMix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/* equivalent to 2^128 calls of XoshiroNext(), gives a non-overlapping subsequence */
+void XoshiroJump(uint64_t s[4]) {
+    static const uint64_t JUMP[] = {
+        0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull,
+        0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull,
+    };
+
+    uint64_t t[4] = {0};
+    for (size_t i = 0; i < sizeof(JUMP) / sizeof(JUMP[0]); i++) {
+        for (int b = 0; b < 64; b++) {
+            if (JUMP[i] & (1ull << b)) {
+                t[0] ^= s[0];
+                t[1] ^= s[1];
+                t[2] ^= s[2];
+                t[3] ^= s[3];
+            }
+            XoshiroNext(s);
+        }
+    }
+
+    memcpy(s, t, sizeof(t));
+}
+
+/* the words of the blocks are kept word-major, every statement of a round is a loop over the blocks */
+void PhiloxRefill(Rng *rng) {
+    uint32_t c0[PHILOX_BLOCKS], c1[PHILOX_BLOCKS], c2[PHILOX_BLOCKS], c3[PHILOX_BLOCKS];
+
+    uint64_t index = ((uint64_t)rng->ctr[1] << 32) | rng->ctr[0];
+    for (uint32_t b = 0; b < PHILOX_BLOCKS; b++) {
+        c0[b] = (uint32_t)(index + b);
+        c1[b] = (uint32_t)((index + b) >> 32);
+        c2[b] = rng->ctr[2];
+        c3[b] = rng->ctr[3];
+    }
+
+    index += PHILOX_BLOCKS;
+    rng->ctr[0] = (uint32_t)index;
+    rng->ctr[1] = (uint32_t)(index >> 32);
+
+    uint32_t key0 = rng->key[0], key1 = rng->key[1];
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        for (int b = 0; b < PHILOX_BLOCKS; b++) {
+            uint64_t p0 = (uint64_t)PHILOX_M0 * c0[b];
+            uint64_t p1 = (uint64_t)PHILOX_M1 * c2[b];
+
+            c0[b] = (uint32_t)(p1 >> 32) ^ c1[b] ^ key0;
+            c2[b] = (uint32_t)(p0 >> 32) ^ c3[b] ^ key1;
+            c1[b] = (uint32_t)p1;
+            c3[b] = (uint32_t)p0;
+        }
+
+        key0 += PHILOX_W0;
+        key1 += PHILOX_W1;
+    }
+
+    for (int b = 0; b < PHILOX_BLOCKS; b++) {
+        rng->out[4 * b]     = c0[b];
+        rng->out[4 * b + 1] = c1[b];
+        rng->out[4 * b + 2] = c2[b];
+        rng->out[4 * b + 3] = c3[b];
+    }
+
+    rng->used = 0;
+}
+
+/*
+    xoshiro: the state of every stream is expanded by SplitMix64 from
+    (seed, stream), XoshiroJump() splits a stream into non-overlapping lanes.
+    philox: the key is the seed, the stream occupies the upper half of the counter
+*/
+void RngInit(Rng *rng, RngKind kind, uint64_t seed, uint64_t stream) {
+    assert(rng);
+
+    memset(rng, 0, sizeof(*rng));
+    rng->kind = kind;
+
+    switch (kind) {
+        case RNG_XOSHIRO: {
+            uint64_t sm = seed ^ (stream * STREAM_STEP);
+            for (int i = 0; i < 4; i++) {
+                rng->s[i] = SplitMix64(&sm);
+            }
+            break;
+        }
+        case RNG_PHILOX:
+            rng->key[0] = (uint32_t)seed;
+            rng->key[1] = (uint32_t)(seed >> 32);
+            rng->ctr[2] = (uint32_t)stream;
+            rng->ctr[3] = (uint32_t)(stream >> 32);
+            rng->used   = 2 * PHILOX_BLOCKS;
+            rng->refill = SelectPhiloxRefill();
+            break;
+        default:
+            assert(0 && "unknown rng kind");
+            break;
+    }
+}
+
+const char* RngName(RngKind kind) {
+    switch (kind) {
+        case RNG_XOSHIRO:   return "xoshiro256**";
+        case RNG_PHILOX:    return "philox4x32-10";
+        default:            return "unknown";
+    }
+}
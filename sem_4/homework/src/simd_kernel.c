@@ -0,0 +1,715 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <pthread.h>
+
+/* gcc 12 avx512 headers use _mm512_undefined_*() and trip these warnings at -O0 */
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#include <immintrin.h>
+
+#include "simd_kernel.h"
+#include "rng.h"
+
+#define AVX2_TARGET     __attribute__((target("avx2,fma")))
+#define AVX512_TARGET   __attribute__((target("avx512f")))
+
+/*
+    e^x = 2^n * e^r, n = round(x * log2(e)), |r| <= ln2 / 2,
+    e^r by Taylor series up to r^11 (relative error < 1e-14).
+    n is taken from the low mantissa bits of x * log2(e) + 1.5 * 2^52
+*/
+static const double EXP_MAGIC   = 6755399441055744.0;           // 1.5 * 2^52
+static const double LOG2E       = 1.4426950408889634074;
+static const double LN2_HI      = 6.93147180369123816490e-01;
+static const double LN2_LO      = 1.90821492927058770002e-10;
+static const double EXP_MIN_ARG = -708.0;
+static const double EXP_MAX_ARG = 709.0;
+
+static const double EXP_COEF[] = {
+    1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0,
+    1.0 / 5040.0,     1.0 / 720.0,     1.0 / 120.0,    1.0 / 24.0,
+    1.0 / 6.0,        1.0 / 2.0,       1.0,            1.0,
+};
+static const size_t EXP_NUM_COEF = sizeof(EXP_COEF) / sizeof(EXP_COEF[0]);
+
+static const uint64_t ONE_BITS = 0x3FF0000000000000ull;   // 1.0, mantissa is filled with random bits
+
+/*
+    float32: the same reduction with n from 1.5 * 2^23, ln2 split so n * LN2_HI_F
+    is exact, Taylor series up to r^7 (relative error about 1e-7, float epsilon)
+*/
+static const float EXPF_MAGIC   = 12582912.0f;                  // 1.5 * 2^23
+static const float LOG2E_F      = 1.44269504f;
+static const float LN2_HI_F     = 0.693359375f;
+static const float LN2_LO_F     = -2.12194440e-4f;
+static const float EXPF_MIN_ARG = -87.0f;
+static const float EXPF_MAX_ARG = 88.0f;
+static const float UNIFORM_F    = 0x1.0p-24f;                   // the top 24 bits of a word as [0, 1)
+
+static const float EXPF_COEF[] = {
+    1.0f / 5040.0f, 1.0f / 720.0f, 1.0f / 120.0f, 1.0f / 24.0f,
+    1.0f / 6.0f,    1.0f / 2.0f,   1.0f,          1.0f,
+};
+static const size_t EXPF_NUM_COEF = sizeof(EXPF_COEF) / sizeof(EXPF_COEF[0]);
+
+/*
+    every kernel samples EXP_LANES xoshiro lanes, point i of a call comes from
+    lane i % EXP_LANES, so all widths (and the scalar kernel) count the same
+    points: the AVX2 kernels run the lanes as two halves of four
+*/
+#define EXP_LANES 8
+
+/*
+    the float kernels draw the words of two iterations of the double kernel and
+    pack them into one vector, bit 2k of the mask is lane first_lane + k of the
+    first iteration and bit 2k + 1 the same lane of the second, so they sample
+    the same points (rounded to float) and the difference of the results is the
+    float bias
+*/
+static unsigned PairedTailMask(size_t remaining, size_t first_lane, size_t n_lanes) {
+    unsigned mask = 0;
+    for (size_t bit = 0; bit < 2 * n_lanes; bit++) {
+        size_t lane  = first_lane + bit / 2;
+        size_t point = (bit % 2 == 0) ? lane : EXP_LANES + lane;
+        if (point < remaining) mask |= 1u << bit;
+    }
+
+    return mask;
+}
+
+/* points first_lane.. of the remaining ones that fall into a half of n_lanes */
+static unsigned TailMask(size_t remaining, size_t first_lane, size_t n_lanes) {
+    if (remaining <= first_lane) return 0;
+    if (remaining - first_lane >= n_lanes) return (1u << n_lanes) - 1;
+
+    return (1u << (remaining - first_lane)) - 1;
+}
+
+/* lanes[word][lane], lane k is the base state jumped k times */
+static void SplitLanes(uint64_t *lanes, const uint64_t state[4]) {
+    uint64_t s[4] = { state[0], state[1], state[2], state[3] };
+
+    for (size_t lane = 0; lane < EXP_LANES; lane++) {
+        for (size_t word = 0; word < 4; word++) {
+            lanes[word * EXP_LANES + lane] = s[word];
+        }
+        XoshiroJump(s);
+    }
+}
+
+// =============================== scalar ===============================
+
+/* ExpAvx2()/ExpAvx512() one lane at a time, fma() rounds like the vector instructions */
+static inline double ExpLane(double x) {
+    x = (x < EXP_MAX_ARG) ? x : EXP_MAX_ARG;
+    x = (x > EXP_MIN_ARG) ? x : EXP_MIN_ARG;
+
+    double t = fma(x, LOG2E, EXP_MAGIC);
+    double n = t - EXP_MAGIC;
+    double r = fma(-n, LN2_HI, x);
+    r        = fma(-n, LN2_LO, r);
+
+    double p = EXP_COEF[0];
+    for (size_t i = 1; i < EXP_NUM_COEF; i++) {
+        p = fma(p, r, EXP_COEF[i]);
+    }
+
+    uint64_t t_bits = 0, magic_bits = 0;
+    memcpy(&t_bits,     &t,         sizeof(t));
+    memcpy(&magic_bits, &EXP_MAGIC, sizeof(EXP_MAGIC));
+
+    uint64_t scale_bits = (t_bits - magic_bits + 1023) << 52;
+    double   scale      = 0;
+    memcpy(&scale, &scale_bits, sizeof(scale));
+
+    return p * scale;
+}
+
+static inline double UniformLane(uint64_t s[4]) {
+    uint64_t bits = (XoshiroNext(s) >> 12) | ONE_BITS;
+    double   u    = 0;
+    memcpy(&u, &bits, sizeof(u));
+
+    return u - 1.0;
+}
+
+static inline float ExpLaneF(float x) {
+    x = (x < EXPF_MAX_ARG) ? x : EXPF_MAX_ARG;
+    x = (x > EXPF_MIN_ARG) ? x : EXPF_MIN_ARG;
+
+    float t = fmaf(x, LOG2E_F, EXPF_MAGIC);
+    float n = t - EXPF_MAGIC;
+    float r = fmaf(-n, LN2_HI_F, x);
+    r       = fmaf(-n, LN2_LO_F, r);
+
+    float p = EXPF_COEF[0];
+    for (size_t i = 1; i < EXPF_NUM_COEF; i++) {
+        p = fmaf(p, r, EXPF_COEF[i]);
+    }
+
+    uint32_t t_bits = 0, magic_bits = 0;
+    memcpy(&t_bits,     &t,          sizeof(t));
+    memcpy(&magic_bits, &EXPF_MAGIC, sizeof(EXPF_MAGIC));
+
+    uint32_t scale_bits = (t_bits - magic_bits + 127) << 23;
+    float    scale      = 0;
+    memcpy(&scale, &scale_bits, sizeof(scale));
+
+    return p * scale;
+}
+
+static inline float UniformLaneF(uint64_t word) {
+    return (float)(int32_t)(word >> 40) * UNIFORM_F;
+}
+
+size_t ExpHitsScalar(double x_min, double x_max, double y_min, double y_max,
+                     size_t n_points, const uint64_t state[4]) {
+    uint64_t init[4 * EXP_LANES];
+    SplitLanes(init, state);
+
+    uint64_t s[EXP_LANES][4];
+    for (size_t lane = 0; lane < EXP_LANES; lane++) {
+        for (size_t word = 0; word < 4; word++) {
+            s[lane][word] = init[word * EXP_LANES + lane];
+        }
+    }
+
+    double dx = x_max - x_min, dy = y_max - y_min;
+
+    size_t hits = 0;
+    for (size_t i = 0; i < n_points; i += EXP_LANES) {
+        for (size_t lane = 0; lane < EXP_LANES; lane++) {
+            double x = fma(UniformLane(s[lane]), dx, x_min);
+            double y = fma(UniformLane(s[lane]), dy, y_min);
+
+            if (i + lane < n_points && y <= ExpLane(x)) hits++;
+        }
+    }
+
+    return hits;
+}
+
+size_t ExpHitsScalarF(double x_min, double x_max, double y_min, double y_max,
+                      size_t n_points, const uint64_t state[4]) {
+    uint64_t init[4 * EXP_LANES];
+    SplitLanes(init, state);
+
+    uint64_t s[EXP_LANES][4];
+    for (size_t lane = 0; lane < EXP_LANES; lane++) {
+        for (size_t word = 0; word < 4; word++) {
+            s[lane][word] = init[word * EXP_LANES + lane];
+        }
+    }
+
+    float x0 = (float)x_min, dx = (float)(x_max - x_min);
+    float y0 = (float)y_min, dy = (float)(y_max - y_min);
+
+    size_t hits = 0;
+    for (size_t i = 0; i < n_points; i += 2 * EXP_LANES) {
+        for (size_t lane = 0; lane < EXP_LANES; lane++) {
+            uint64_t xa = XoshiroNext(s[lane]), ya = XoshiroNext(s[lane]);
+            uint64_t xb = XoshiroNext(s[lane]), yb = XoshiroNext(s[lane]);
+
+            float x = fmaf(UniformLaneF(xa), dx, x0), y = fmaf(UniformLaneF(ya), dy, y0);
+            if (i + lane < n_points && y <= ExpLaneF(x)) hits++;
+
+            x = fmaf(UniformLaneF(xb), dx, x0);
+            y = fmaf(UniformLaneF(yb), dy, y0);
+            if (i + EXP_LANES + lane < n_points && y <= ExpLaneF(x)) hits++;
+        }
+    }
+
+    return hits;
+}
+
+// ================================ AVX2 ================================
+
+#define ROTL256(x, k) _mm256_or_si256(_mm256_slli_epi64((x), (k)), _mm256_srli_epi64((x), 64 - (k)))
+
+AVX2_TARGET static inline __m256i NextAvx2(__m256i s[4]) {
+    __m256i s1x5   = _mm256_add_epi64(_mm256_slli_epi64(s[1], 2), s[1]);
+    __m256i rot    = ROTL256(s1x5, 7);
+    __m256i result = _mm256_add_epi64(_mm256_slli_epi64(rot, 3), rot);
+    __m256i t      = _mm256_slli_epi64(s[1], 17);
+
+    s[2] = _mm256_xor_si256(s[2], s[0]);
+    s[3] = _mm256_xor_si256(s[3], s[1]);
+    s[1] = _mm256_xor_si256(s[1], s[2]);
+    s[0] = _mm256_xor_si256(s[0], s[3]);
+    s[2] = _mm256_xor_si256(s[2], t);
+    s[3] = ROTL256(s[3], 45);
+
+    return result;
+}
+
+/* uniform [0, 1) from the upper 52 bits */
+AVX2_TARGET static inline __m256d UniformAvx2(__m256i s[4]) {
+    __m256i bits = _mm256_or_si256(_mm256_srli_epi64(NextAvx2(s), 12), _mm256_set1_epi64x((long long)ONE_BITS));
+    return _mm256_sub_pd(_mm256_castsi256_pd(bits), _mm256_set1_pd(1.0));
+}
+
+AVX2_TARGET static inline __m256d ExpAvx2(__m256d x) {
+    x = _mm256_max_pd(_mm256_min_pd(x, _mm256_set1_pd(EXP_MAX_ARG)), _mm256_set1_pd(EXP_MIN_ARG));
+
+    __m256d magic = _mm256_set1_pd(EXP_MAGIC);
+    __m256d t     = _mm256_fmadd_pd(x, _mm256_set1_pd(LOG2E), magic);
+    __m256d n     = _mm256_sub_pd(t, magic);
+    __m256d r     = _mm256_fnmadd_pd(n, _mm256_set1_pd(LN2_HI), x);
+    r             = _mm256_fnmadd_pd(n, _mm256_set1_pd(LN2_LO), r);
+
+    __m256d p = _mm256_set1_pd(EXP_COEF[0]);
+    for (size_t i = 1; i < EXP_NUM_COEF; i++) {
+        p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(EXP_COEF[i]));
+    }
+
+    __m256i ni    = _mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(magic));
+    __m256i scale = _mm256_slli_epi64(_mm256_add_epi64(ni, _mm256_set1_epi64x(1023)), 52);
+
+    return _mm256_mul_pd(p, _mm256_castsi256_pd(scale));
+}
+
+AVX2_TARGET size_t ExpHitsAvx2(double x_min, double x_max, double y_min, double y_max,
+                               size_t n_points, const uint64_t state[4]) {
+    uint64_t init[4 * EXP_LANES];
+    SplitLanes(init, state);
+
+    /* lanes 0-3 and 4-7 */
+    __m256i lo[4], hi[4];
+    for (size_t word = 0; word < 4; word++) {
+        lo[word] = _mm256_loadu_si256((const __m256i*)&init[word * EXP_LANES]);
+        hi[word] = _mm256_loadu_si256((const __m256i*)&init[word * EXP_LANES + 4]);
+    }
+
+    __m256d x0 = _mm256_set1_pd(x_min), dx = _mm256_set1_pd(x_max - x_min);
+    __m256d y0 = _mm256_set1_pd(y_min), dy = _mm256_set1_pd(y_max - y_min);
+
+    size_t hits = 0;
+    for (size_t i = 0; i < n_points; i += EXP_LANES) {
+        __m256d x_lo = _mm256_fmadd_pd(UniformAvx2(lo), dx, x0);
+        __m256d y_lo = _mm256_fmadd_pd(UniformAvx2(lo), dy, y0);
+        __m256d x_hi = _mm256_fmadd_pd(UniformAvx2(hi), dx, x0);
+        __m256d y_hi = _mm256_fmadd_pd(UniformAvx2(hi), dy, y0);
+
+        unsigned mask_lo = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(y_lo, ExpAvx2(x_lo), _CMP_LE_OQ));
+        unsigned mask_hi = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(y_hi, ExpAvx2(x_hi), _CMP_LE_OQ));
+        if (n_points - i < EXP_LANES) {
+            mask_lo &= TailMask(n_points - i, 0, 4);
+            mask_hi &= TailMask(n_points - i, 4, 4);
+        }
+
+        hits += (size_t)__builtin_popcount(mask_lo) + (size_t)__builtin_popcount(mask_hi);
+    }
+
+    return hits;
+}
+
+/* top 24 bits of the words of a into the low halves of the 64-bit lanes, of b into the high ones */
+AVX2_TARGET static inline __m256 UniformPairAvx2F(__m256i a, __m256i b) {
+    __m256i bits = _mm256_or_si256(_mm256_srli_epi64(a, 40), _mm256_slli_epi64(_mm256_srli_epi64(b, 40), 32));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(UNIFORM_F));
+}
+
+AVX2_TARGET static inline __m256 ExpAvx2F(__m256 x) {
+    x = _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(EXPF_MAX_ARG)), _mm256_set1_ps(EXPF_MIN_ARG));
+
+    __m256 magic = _mm256_set1_ps(EXPF_MAGIC);
+    __m256 t     = _mm256_fmadd_ps(x, _mm256_set1_ps(LOG2E_F), magic);
+    __m256 n     = _mm256_sub_ps(t, magic);
+    __m256 r     = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_HI_F), x);
+    r            = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_LO_F), r);
+
+    __m256 p = _mm256_set1_ps(EXPF_COEF[0]);
+    for (size_t i = 1; i < EXPF_NUM_COEF; i++) {
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXPF_COEF[i]));
+    }
+
+    __m256i ni    = _mm256_sub_epi32(_mm256_castps_si256(t), _mm256_castps_si256(magic));
+    __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(ni, _mm256_set1_epi32(127)), 23);
+
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+}
+
+/* one half of ExpHitsAvx2F(): two iterations of four lanes */
+AVX2_TARGET static inline unsigned PairHitsAvx2F(__m256i s[4], __m256 x0, __m256 dx, __m256 y0, __m256 dy) {
+    __m256i xa = NextAvx2(s), ya = NextAvx2(s);
+    __m256i xb = NextAvx2(s), yb = NextAvx2(s);
+
+    __m256 x = _mm256_fmadd_ps(UniformPairAvx2F(xa, xb), dx, x0);
+    __m256 y = _mm256_fmadd_ps(UniformPairAvx2F(ya, yb), dy, y0);
+
+    return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(y, ExpAvx2F(x), _CMP_LE_OQ));
+}
+
+AVX2_TARGET size_t ExpHitsAvx2F(double x_min, double x_max, double y_min, double y_max,
+                                size_t n_points, const uint64_t state[4]) {
+    uint64_t init[4 * EXP_LANES];
+    SplitLanes(init, state);
+
+    __m256i lo[4], hi[4];
+    for (size_t word = 0; word < 4; word++) {
+        lo[word] = _mm256_loadu_si256((const __m256i*)&init[word * EXP_LANES]);
+        hi[word] = _mm256_loadu_si256((const __m256i*)&init[word * EXP_LANES + 4]);
+    }
+
+    __m256 x0 = _mm256_set1_ps((float)x_min), dx = _mm256_set1_ps((float)(x_max - x_min));
+    __m256 y0 = _mm256_set1_ps((float)y_min), dy = _mm256_set1_ps((float)(y_max - y_min));
+
+    size_t hits = 0;
+    for (size_t i = 0; i < n_points; i += 2 * EXP_LANES) {
+        unsigned mask_lo = PairHitsAvx2F(lo, x0, dx, y0, dy);
+        unsigned mask_hi = PairHitsAvx2F(hi, x0, dx, y0, dy);
+        if (n_points - i < 2 * EXP_LANES) {
+            mask_lo &= PairedTailMask(n_points - i, 0, 4);
+            mask_hi &= PairedTailMask(n_points - i, 4, 4);
+        }
+
+        hits += (size_t)__builtin_popcount(mask_lo) + (size_t)__builtin_popcount(mask_hi);
+    }
+
+    return hits;
+}
+
+// =============================== AVX-512 ===============================
+
+AVX512_TARGET static inline __m512i NextAvx512(__m512i s[4]) {
+    __m512i s1x5   = _mm512_add_epi64(_mm512_slli_epi64(s[1], 2), s[1]);
+    __m512i rot    = _mm512_rol_epi64(s1x5, 7);
+    __m512i result = _mm512_add_epi64(_mm512_slli_epi64(rot, 3), rot);
+    __m512i t      = _mm512_slli_epi64(s[1], 17);
+
+    s[2] = _mm512_xor_si512(s[2], s[0]);
+    s[3] = _mm512_xor_si512(s[3], s[1]);
+    s[1] = _mm512_xor_si512(s[1], s[2]);
+    s[0] = _mm512_xor_si512(s[0], s[3]);
+    s[2] = _mm512_xor_si512(s[2], t);
+    s[3] = _mm512_rol_epi64(s[3], 45);
+
+    return result;
+}
+
+AVX512_TARGET static inline __m512d UniformAvx512(__m512i s[4]) {
+    __m512i bits = _mm512_or_si512(_mm512_srli_epi64(NextAvx512(s), 12), _mm512_set1_epi64((long long)ONE_BITS));
+    return _mm512_sub_pd(_mm512_castsi512_pd(bits), _mm512_set1_pd(1.0));
+}
+
+AVX512_TARGET static inline __m512d ExpAvx512(__m512d x) {
+    x = _mm512_max_pd(_mm512_min_pd(x, _mm512_set1_pd(EXP_MAX_ARG)), _mm512_set1_pd(EXP_MIN_ARG));
+
+    __m512d magic = _mm512_set1_pd(EXP_MAGIC);
+    __m512d t     = _mm512_fmadd_pd(x, _mm512_set1_pd(LOG2E), magic);
+    __m512d n     = _mm512_sub_pd(t, magic);
+    __m512d r     = _mm512_fnmadd_pd(n, _mm512_set1_pd(LN2_HI), x);
+    r             = _mm512_fnmadd_pd(n, _mm512_set1_pd(LN2_LO), r);
+
+    __m512d p = _mm512_set1_pd(EXP_COEF[0]);
+    for (size_t i = 1; i < EXP_NUM_COEF; i++) {
+        p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(EXP_COEF[i]));
+    }
+
+    __m512i ni    = _mm512_sub_epi64(_mm512_castpd_si512(t), _mm512_castpd_si512(magic));
+    __m512i scale = _mm512_slli_epi64(_mm512_add_epi64(ni, _mm512_set1_epi64(1023)), 52);
+
+    return _mm512_mul_pd(p, _mm512_castsi512_pd(scale));
+}
+
+AVX512_TARGET size_t ExpHitsAvx512(double x_min, double x_max, double y_min, double y_max,
+                                   size_t n_points, const uint64_t state[4]) {
+    uint64_t init[4 * EXP_LANES];
+    SplitLanes(init, state);
+
+    __m512i s[4];
+    for (size_t word = 0; word < 4; word++) {
+        s[word] = _mm512_loadu_si512(&init[word * EXP_LANES]);
+    }
+
+    __m512d x0 = _mm512_set1_pd(x_min), dx = _mm512_set1_pd(x_max - x_min);
+    __m512d y0 = _mm512_set1_pd(y_min), dy = _mm512_set1_pd(y_max - y_min);
+
+    size_t hits = 0;
+    for (size_t i = 0; i < n_points; i += EXP_LANES) {
+        __m512d x = _mm512_fmadd_pd(UniformAvx512(s), dx, x0);
+        __m512d y = _mm512_fmadd_pd(UniformAvx512(s), dy, y0);
+
+        __mmask8 mask = _mm512_cmp_pd_mask(y, ExpAvx512(x), _CMP_LE_OQ);
+        if (n_points - i < EXP_LANES) mask &= (__mmask8)TailMask(n_points - i, 0, EXP_LANES);
+
+        hits += (size_t)__builtin_popcount(mask);
+    }
+
+    return hits;
+}
+
+AVX512_TARGET static inline __m512 UniformPairAvx512F(__m512i a, __m512i b) {
+    __m512i bits = _mm512_or_si512(_mm512_srli_epi64(a, 40), _mm512_slli_epi64(_mm512_srli_epi64(b, 40), 32));
+    return _mm512_mul_ps(_mm512_cvtepi32_ps(bits), _mm512_set1_ps(UNIFORM_F));
+}
+
+AVX512_TARGET static inline __m512 ExpAvx512F(__m512 x) {
+    x = _mm512_max_ps(_mm512_min_ps(x, _mm512_set1_ps(EXPF_MAX_ARG)), _mm512_set1_ps(EXPF_MIN_ARG));
+
+    __m512 magic = _mm512_set1_ps(EXPF_MAGIC);
+    __m512 t     = _mm512_fmadd_ps(x, _mm512_set1_ps(LOG2E_F), magic);
+    __m512 n     = _mm512_sub_ps(t, magic);
+    __m512 r     = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_HI_F), x);
+    r            = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_LO_F), r);
+
+    __m512 p = _mm512_set1_ps(EXPF_COEF[0]);
+    for (size_t i = 1; i < EXPF_NUM_COEF; i++) {
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXPF_COEF[i]));
+    }
+
+    __m512i ni    = _mm512_sub_epi32(_mm512_castps_si512(t), _mm512_castps_si512(magic));
+    __m512i scale = _mm512_slli_epi32(_mm512_add_epi32(ni, _mm512_set1_epi32(127)), 23);
+
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(scale));
+}
+
+AVX512_TARGET size_t ExpHitsAvx512F(double x_min, double x_max, double y_min, double y_max,
+                                    size_t n_points, const uint64_t state[4]) {
+    uint64_t init[4 * EXP_LANES];
+    SplitLanes(init, state);
+
+    __m512i s[4];
+    for (size_t word = 0; word < 4; word++) {
+        s[word] = _mm512_loadu_si512(&init[word * EXP_LANES]);
+    }
+
+    __m512 x0 = _mm512_set1_ps((float)x_min), dx = _mm512_set1_ps((float)(x_max - x_min));
+    __m512 y0 = _mm512_set1_ps((float)y_min), dy = _mm512_set1_ps((float)(y_max - y_min));
+
+    size_t hits = 0;
+    for (size_t i = 0; i < n_points; i += 2 * EXP_LANES) {
+        __m512i xa = NextAvx512(s), ya = NextAvx512(s);
+        __m512i xb = NextAvx512(s), yb = NextAvx512(s);
+
+        __m512 x = _mm512_fmadd_ps(UniformPairAvx512F(xa, xb), dx, x0);
+        __m512 y = _mm512_fmadd_ps(UniformPairAvx512F(ya, yb), dy, y0);
+
+        __mmask16 mask = _mm512_cmp_ps_mask(y, ExpAvx512F(x), _CMP_LE_OQ);
+        if (n_points - i < 2 * EXP_LANES) mask &= (__mmask16)PairedTailMask(n_points - i, 0, EXP_LANES);
+
+        hits += (size_t)__builtin_popcount(mask);
+    }
+
+    return hits;
+}
+
+// ============================ Philox refill ============================
+
+/*
+    the portable PhiloxRefill() with PHILOX_BLOCKS blocks in the lanes: the
+    32x32 -> 64 products of the even and odd lanes come from two mul_epu32,
+    their high and low halves are blended back into 32-bit lanes. The output is
+    transposed to the block-major order of the portable one, so every refill
+    produces the same stream
+*/
+
+/* words 0 and 1 of the blocks: the 64-bit block index */
+static void PhiloxCounters(Rng *rng, uint32_t c0[PHILOX_BLOCKS], uint32_t c1[PHILOX_BLOCKS]) {
+    uint64_t index = ((uint64_t)rng->ctr[1] << 32) | rng->ctr[0];
+
+    for (uint32_t b = 0; b < PHILOX_BLOCKS; b++) {
+        c0[b] = (uint32_t)(index + b);
+        c1[b] = (uint32_t)((index + b) >> 32);
+    }
+
+    index += PHILOX_BLOCKS;
+    rng->ctr[0] = (uint32_t)index;
+    rng->ctr[1] = (uint32_t)(index >> 32);
+}
+
+AVX2_TARGET static inline void MulHiLoAvx2(__m256i a, __m256i m, __m256i *hi, __m256i *lo) {
+    __m256i even = _mm256_mul_epu32(a, m);
+    __m256i odd  = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+
+    *hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    *lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+}
+
+AVX2_TARGET void PhiloxRefillAvx2(Rng *rng) {
+    enum { GROUPS = PHILOX_BLOCKS / 8 };
+
+    uint32_t w0[PHILOX_BLOCKS], w1[PHILOX_BLOCKS];
+    __m256i  c0[GROUPS], c1[GROUPS], c2[GROUPS], c3[GROUPS];
+
+    PhiloxCounters(rng, w0, w1);
+    for (int g = 0; g < GROUPS; g++) {
+        c0[g] = _mm256_loadu_si256((const __m256i*)&w0[8 * g]);
+        c1[g] = _mm256_loadu_si256((const __m256i*)&w1[8 * g]);
+        c2[g] = _mm256_set1_epi32((int)rng->ctr[2]);
+        c3[g] = _mm256_set1_epi32((int)rng->ctr[3]);
+    }
+
+    __m256i m0   = _mm256_set1_epi64x(PHILOX_M0), m1 = _mm256_set1_epi64x(PHILOX_M1);
+    __m256i key0 = _mm256_set1_epi32((int)rng->key[0]);
+    __m256i key1 = _mm256_set1_epi32((int)rng->key[1]);
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        for (int g = 0; g < GROUPS; g++) {
+            __m256i hi0, lo0, hi1, lo1;
+            MulHiLoAvx2(c0[g], m0, &hi0, &lo0);
+            MulHiLoAvx2(c2[g], m1, &hi1, &lo1);
+
+            c0[g] = _mm256_xor_si256(_mm256_xor_si256(hi1, c1[g]), key0);
+            c2[g] = _mm256_xor_si256(_mm256_xor_si256(hi0, c3[g]), key1);
+            c1[g] = lo1;
+            c3[g] = lo0;
+        }
+
+        key0 = _mm256_add_epi32(key0, _mm256_set1_epi32((int)PHILOX_W0));
+        key1 = _mm256_add_epi32(key1, _mm256_set1_epi32((int)PHILOX_W1));
+    }
+
+    /* 4 words x 8 blocks -> 8 blocks of 4 words, u<k> holds blocks k and k + 4 */
+    for (int g = 0; g < GROUPS; g++) {
+        __m256i t0 = _mm256_unpacklo_epi32(c0[g], c1[g]), t1 = _mm256_unpackhi_epi32(c0[g], c1[g]);
+        __m256i t2 = _mm256_unpacklo_epi32(c2[g], c3[g]), t3 = _mm256_unpackhi_epi32(c2[g], c3[g]);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2),       u1 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3),       u3 = _mm256_unpackhi_epi64(t1, t3);
+
+        __m256i *out = (__m256i*)&rng->out[32 * g];
+        _mm256_storeu_si256(out,     _mm256_permute2x128_si256(u0, u1, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(u2, u3, 0x20));
+        _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(u0, u1, 0x31));
+        _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(u2, u3, 0x31));
+    }
+
+    rng->used = 0;
+}
+
+AVX512_TARGET static inline void MulHiLoAvx512(__m512i a, __m512i m, __m512i *hi, __m512i *lo) {
+    __m512i even = _mm512_mul_epu32(a, m);
+    __m512i odd  = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), m);
+
+    *hi = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+    *lo = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+}
+
+AVX512_TARGET void PhiloxRefillAvx512(Rng *rng) {
+    uint32_t w0[PHILOX_BLOCKS], w1[PHILOX_BLOCKS];
+    PhiloxCounters(rng, w0, w1);
+
+    __m512i c0 = _mm512_loadu_si512(w0), c1 = _mm512_loadu_si512(w1);
+    __m512i c2 = _mm512_set1_epi32((int)rng->ctr[2]), c3 = _mm512_set1_epi32((int)rng->ctr[3]);
+
+    __m512i m0   = _mm512_set1_epi64(PHILOX_M0), m1 = _mm512_set1_epi64(PHILOX_M1);
+    __m512i key0 = _mm512_set1_epi32((int)rng->key[0]);
+    __m512i key1 = _mm512_set1_epi32((int)rng->key[1]);
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        __m512i hi0, lo0, hi1, lo1;
+        MulHiLoAvx512(c0, m0, &hi0, &lo0);
+        MulHiLoAvx512(c2, m1, &hi1, &lo1);
+
+        c0 = _mm512_ternarylogic_epi32(hi1, c1, key0, 0x96);      // a ^ b ^ c
+        c2 = _mm512_ternarylogic_epi32(hi0, c3, key1, 0x96);
+        c1 = lo1;
+        c3 = lo0;
+
+        key0 = _mm512_add_epi32(key0, _mm512_set1_epi32((int)PHILOX_W0));
+        key1 = _mm512_add_epi32(key1, _mm512_set1_epi32((int)PHILOX_W1));
+    }
+
+    /* as in the AVX2 one, u<k> holds blocks k, k + 4, k + 8, k + 12 in its 128-bit lanes */
+    __m512i t0 = _mm512_unpacklo_epi32(c0, c1), t1 = _mm512_unpackhi_epi32(c0, c1);
+    __m512i t2 = _mm512_unpacklo_epi32(c2, c3), t3 = _mm512_unpackhi_epi32(c2, c3);
+    __m512i u0 = _mm512_unpacklo_epi64(t0, t2), u1 = _mm512_unpackhi_epi64(t0, t2);
+    __m512i u2 = _mm512_unpacklo_epi64(t1, t3), u3 = _mm512_unpackhi_epi64(t1, t3);
+
+    __m512i low  = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    __m512i high = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    __m512i v01  = _mm512_permutex2var_epi64(u0, low,  u1);        // blocks 0, 1, 4, 5
+    __m512i v23  = _mm512_permutex2var_epi64(u2, low,  u3);        // blocks 2, 3, 6, 7
+    __m512i v89  = _mm512_permutex2var_epi64(u0, high, u1);        // blocks 8, 9, 12, 13
+    __m512i vab  = _mm512_permutex2var_epi64(u2, high, u3);        // blocks 10, 11, 14, 15
+
+    __m512i first  = _mm512_setr_epi64(0, 1, 2, 3, 8, 9, 10, 11);
+    __m512i second = _mm512_setr_epi64(4, 5, 6, 7, 12, 13, 14, 15);
+    _mm512_storeu_si512(&rng->out[0],  _mm512_permutex2var_epi64(v01, first,  v23));
+    _mm512_storeu_si512(&rng->out[16], _mm512_permutex2var_epi64(v01, second, v23));
+    _mm512_storeu_si512(&rng->out[32], _mm512_permutex2var_epi64(v89, first,  vab));
+    _mm512_storeu_si512(&rng->out[48], _mm512_permutex2var_epi64(v89, second, vab));
+
+    rng->used = 0;
+}
+
+enum SimdLevel {
+    SIMD_OFF,
+    SIMD_SCALAR,
+    SIMD_AVX2,
+    SIMD_AVX512,
+};
+
+/*
+    MC_SIMD=off|scalar|avx2|avx512 in the environment caps the choice (for benchmarks),
+    off leaves the integrand to the generic scalar loop
+*/
+static enum SimdLevel SimdLimit(void) {
+    static _Atomic int warned = 0;
+
+    const char *limit = getenv("MC_SIMD");
+    if (limit == NULL || limit[0] == '\0')  return SIMD_AVX512;
+    if (strcmp(limit, "avx512") == 0)       return SIMD_AVX512;
+    if (strcmp(limit, "avx2") == 0)         return SIMD_AVX2;
+    if (strcmp(limit, "scalar") == 0)       return SIMD_SCALAR;
+    if (strcmp(limit, "off") == 0)          return SIMD_OFF;
+
+    if (!atomic_exchange(&warned, 1)) {
+        fprintf(stderr, "unknown MC_SIMD=%s (off, scalar, avx2 or avx512), using the best kernel\n", limit);
+    }
+
+    return SIMD_AVX512;
+}
+
+ExpHitKernel SelectExpHitKernel(void) {
+    enum SimdLevel limit = SimdLimit();
+
+    __builtin_cpu_init();
+
+    if (limit >= SIMD_AVX512 && __builtin_cpu_supports("avx512f")) {
+        return ExpHitsAvx512;
+    }
+    if (limit >= SIMD_AVX2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return ExpHitsAvx2;
+    }
+
+    return (limit >= SIMD_SCALAR) ? ExpHitsScalar : NULL;
+}
+
+static PhiloxRefillFn selected_refill = NULL;
+
+static void ResolvePhiloxRefill(void) {
+    enum SimdLevel limit = SimdLimit();
+
+    __builtin_cpu_init();
+
+    if (limit >= SIMD_AVX512 && __builtin_cpu_supports("avx512f")) {
+        selected_refill = PhiloxRefillAvx512;
+    } else if (limit >= SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+        selected_refill = PhiloxRefillAvx2;
+    } else {
+        selected_refill = PhiloxRefill;
+    }
+}
+
+/* RngInit() runs per task, the environment and the CPU are looked at once */
+PhiloxRefillFn SelectPhiloxRefill(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, ResolvePhiloxRefill);
+
+    return selected_refill;
+}
+
+/* float32 kernels, the same choice */
+ExpHitKernel SelectExpHitKernelF(void) {
+    ExpHitKernel kernel = SelectExpHitKernel();
+
+    if (kernel == ExpHitsAvx512) return ExpHitsAvx512F;
+    if (kernel == ExpHitsAvx2)   return ExpHitsAvx2F;
+    if (kernel == ExpHitsScalar) return ExpHitsScalarF;
+
+    return NULL;
+}
@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+enum StealResult {
+    STEAL_OK,
+    STEAL_EMPTY,
+    STEAL_ABORT,    // lost a race, the deque may still have tasks
+};
+
+struct WorkerArg {
+    struct ThreadPool*  pool;
+    int                 index;
+};
+
+static int set_this_thread_to_core(int core_num);
+
+int GetNumCores(void) {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (num_cores > 0) ? (int)num_cores : 1;
+}
+
+// ============================== deque ==============================
+
+static int DequeReserve(struct WorkDeque *dq, int64_t cap) {
+    if (dq->cap >= cap) return 0;
+
+    _Atomic size_t *buf = (_Atomic size_t*)calloc((size_t)cap, sizeof(*buf));
+    if (buf == NULL) return -1;
+
+    free(dq->buf);
+    dq->buf = buf;
+    dq->cap = cap;
+
+    return 0;
+}
+
+/* owner only, never called while thieves are active here (tasks are pushed before the job starts) */
+static void DequePush(struct WorkDeque *dq, size_t task) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    assert(b - t < dq->cap);
+    (void)t;
+
+    atomic_store_explicit(&dq->buf[b % dq->cap], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+}
+
+static int DequeTake(struct WorkDeque *dq, size_t *task) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+
+    *task = atomic_load_explicit(&dq->buf[b % dq->cap], memory_order_relaxed);
+    if (t == b) {
+        /* last task: race against thieves */
+        int won = atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                                          memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+
+    return 1;
+}
+
+static enum StealResult DequeSteal(struct WorkDeque *dq, size_t *task) {
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+    if (t >= b) return STEAL_EMPTY;
+
+    *task = atomic_load_explicit(&dq->buf[t % dq->cap], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return STEAL_ABORT;
+    }
+
+    return STEAL_OK;
+}
+
+// ============================== workers ==============================
+
+static void ExecuteJob(struct ThreadPool *pool, int index) {
+    const struct PoolJob *job = pool->job;
+    struct WorkDeque     *own = &pool->deques[index];
+    size_t task = 0;
+
+    for (;;) {
+        if (DequeTake(own, &task)) {
+            job->run(job->ctx, task, index);
+            continue;
+        }
+
+        /* own deque is empty: steal until every other deque is seen empty */
+        int found     = 0;
+        int contended = 0;
+        do {
+            contended = 0;
+            for (int k = 1; k < pool->n_workers && !found; k++) {
+                int victim = (index + k) % pool->n_workers;
+
+                enum StealResult res = DequeSteal(&pool->deques[victim], &task);
+                if (res == STEAL_OK)    found     = 1;
+                if (res == STEAL_ABORT) contended = 1;
+            }
+        } while (!found && contended);
+
+        if (!found) return;
+
+        job->run(job->ctx, task, index);
+    }
+}
+
+static void* WorkerMain(void *args) {
+    assert(args);
+
+    struct WorkerArg  *arg  = (struct WorkerArg*)args;
+    struct ThreadPool *pool = arg->pool;
+
+    int cpu = pool->cpus[arg->index];
+    if (cpu != -1 && set_this_thread_to_core(cpu) != 0) {
+        printf("Failed to pin worker %d to cpu %d\n", arg->index, cpu);
+    }
+
+    /* wait until the pool knows how many workers it really has */
+    pthread_mutex_lock(&pool->init_lock);
+    pthread_mutex_unlock(&pool->init_lock);
+
+    if (pool->hooks.start != NULL) pool->hooks.start(arg->index, pool->hooks.arg);
+
+    for (;;) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->stop) break;
+
+        ExecuteJob(pool, arg->index);
+        pthread_barrier_wait(&pool->done);
+    }
+
+    if (pool->hooks.stop != NULL) pool->hooks.stop(arg->index, pool->hooks.arg);
+
+    free(arg);
+    return NULL;
+}
+
+struct ThreadPool* CreateThreadPool(int n_workers, enum PlacementPolicy placement,
+                                   const struct PoolHooks *hooks) {
+    if (n_workers <= 0) n_workers = GetNumCores();
+
+    struct ThreadPool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        fprintf(stderr, "failed to allocate memory for thread pool\n");
+        return NULL;
+    }
+
+    if (hooks != NULL) pool->hooks = *hooks;
+
+    int max_cpus = CPU_SETSIZE;
+
+    pool->n_workers = n_workers;
+    pool->tid       = calloc((size_t)n_workers, sizeof(*pool->tid));
+    pool->cpus      = calloc((size_t)(n_workers > max_cpus ? n_workers : max_cpus), sizeof(*pool->cpus));
+    pool->deques    = aligned_alloc(CACHE_LINE, (size_t)n_workers * sizeof(*pool->deques));
+    if (pool->tid == NULL || pool->cpus == NULL || pool->deques == NULL) {
+        fprintf(stderr, "failed to allocate memory for workers\n");
+        free(pool->tid);
+        free(pool->cpus);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    /* more workers than CPUs: wrap around the order */
+    int n_cpus = PlacementOrder(placement, pool->cpus, max_cpus);
+    for (int i = n_workers - 1; i >= 0; i--) {
+        pool->cpus[i] = (n_cpus > 0) ? pool->cpus[i % n_cpus] : -1;
+    }
+
+    for (int i = 0; i < n_workers; i++) {
+        atomic_init(&pool->deques[i].top, 0);
+        atomic_init(&pool->deques[i].bottom, 0);
+        pool->deques[i].buf = NULL;
+        pool->deques[i].cap = 0;
+    }
+
+    pthread_mutex_init(&pool->init_lock, NULL);
+    pthread_mutex_lock(&pool->init_lock);
+
+    int created = 0;
+    for (; created < n_workers; created++) {
+        struct WorkerArg *arg = malloc(sizeof(*arg));
+        if (arg == NULL) break;
+
+        arg->pool  = pool;
+        arg->index = created;
+        if (pthread_create(&pool->tid[created], NULL, WorkerMain, arg) != 0) {
+            free(arg);
+            break;
+        }
+    }
+
+    if (created < n_workers) {
+        fprintf(stderr, "failed to create worker %d, running with %d\n", created, created);
+    }
+
+    /* no worker has reached a barrier yet, so the count can still be chosen */
+    pool->n_workers = created;
+    pthread_barrier_init(&pool->start, NULL, (unsigned)created + 1);
+    pthread_barrier_init(&pool->done,  NULL, (unsigned)created + 1);
+    pthread_mutex_unlock(&pool->init_lock);
+
+    if (created == 0) {
+        DestroyThreadPool(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void DestroyThreadPool(struct ThreadPool *pool) {
+    if (pool == NULL) return;
+
+    pool->stop = 1;
+    pthread_barrier_wait(&pool->start);
+
+    for (int i = 0; i < pool->n_workers; i++) {
+        pthread_join(pool->tid[i], NULL);
+    }
+
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->init_lock);
+
+    for (int i = 0; i < pool->n_workers; i++) {
+        free(pool->deques[i].buf);
+    }
+
+    free(pool->deques);
+    free(pool->cpus);
+    free(pool->tid);
+    free(pool);
+}
+
+/* blocks until every task of the job has run */
+int RunPoolJob(struct ThreadPool *pool, const struct PoolJob *job) {
+    if (StartPoolJob(pool, job) == -1) return -1;
+
+    WaitPoolJob(pool);
+    return 0;
+}
+
+/* hands the job to the workers and returns, the caller must WaitPoolJob() before the next one */
+int StartPoolJob(struct ThreadPool *pool, const struct PoolJob *job) {
+    assert(pool);
+    assert(job);
+
+    int    n_workers = pool->n_workers;
+    size_t per_worker = (job->n_tasks + (size_t)n_workers - 1) / (size_t)n_workers;
+
+    for (int w = 0; w < n_workers; w++) {
+        struct WorkDeque *dq = &pool->deques[w];
+        if (DequeReserve(dq, (int64_t)per_worker + 1) == -1) {
+            fprintf(stderr, "failed to allocate memory for deque\n");
+            return -1;
+        }
+
+        atomic_store_explicit(&dq->top, 0, memory_order_relaxed);
+        atomic_store_explicit(&dq->bottom, 0, memory_order_relaxed);
+
+        size_t first = job->n_tasks * (size_t)w / (size_t)n_workers;
+        size_t last  = job->n_tasks * (size_t)(w + 1) / (size_t)n_workers;
+
+        /* pushed in reverse so the owner takes its range front to back */
+        for (size_t task = last; task-- > first;) {
+            DequePush(dq, task);
+        }
+    }
+
+    pool->job = job;
+    pthread_barrier_wait(&pool->start);
+
+    return 0;
+}
+
+void WaitPoolJob(struct ThreadPool *pool) {
+    assert(pool);
+
+    pthread_barrier_wait(&pool->done);
+    pool->job = NULL;
+}
+
+static int set_this_thread_to_core(int core_num) {
+    if (core_num < 0 || core_num >= CPU_SETSIZE) {
+        return -1;
+    }
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET((size_t)core_num, &cpuset);
+
+    pthread_t current = pthread_self();
+    return pthread_setaffinity_np(current, sizeof(cpu_set_t), &cpuset);
+}
@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+
+#include "topology.h"
+
+static const char* POLICY_NAMES[PLACEMENT_COUNT] = {
+    "none", "linear", "compact", "scatter", "physical", "pcores",
+};
+
+static long ReadCpuValue(int cpu, const char *name) {
+    char path[160] = "";
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+
+    long value = -1;
+    if (fscanf(file, "%ld", &value) != 1) value = -1;
+    fclose(file);
+
+    return value;
+}
+
+/* "0-3,8,10-11" -> set */
+static int ReadCpuList(const char *path, cpu_set_t *set) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+
+    char line[1024] = "";
+    int  ret        = (fgets(line, sizeof(line), file) != NULL) ? 0 : -1;
+    fclose(file);
+
+    CPU_ZERO(set);
+
+    for (char *token = strtok(line, ",\n"); token != NULL && ret == 0; token = strtok(NULL, ",\n")) {
+        int first = 0, last = 0;
+        int n     = sscanf(token, "%d-%d", &first, &last);
+
+        if (n == 1) last = first;
+        if (n < 1 || first < 0 || last >= CPU_SETSIZE) {
+            ret = -1;
+            break;
+        }
+
+        for (int cpu = first; cpu <= last; cpu++) CPU_SET((size_t)cpu, set);
+    }
+
+    return ret;
+}
+
+/*
+    P-cores: the kernel lists them in /sys/devices/cpu_core/cpus on Intel hybrid parts,
+    elsewhere the CPUs with the highest maximum frequency count as P-cores
+*/
+static void MarkPerformanceCores(struct CpuInfo *cpus, int n_cpus) {
+    cpu_set_t core_set;
+    if (ReadCpuList("/sys/devices/cpu_core/cpus", &core_set) == 0) {
+        for (int i = 0; i < n_cpus; i++) {
+            cpus[i].pcore = CPU_ISSET((size_t)cpus[i].cpu, &core_set) ? 1 : 0;
+        }
+        return;
+    }
+
+    long max_freq = -1;
+    for (int i = 0; i < n_cpus; i++) {
+        long freq = ReadCpuValue(cpus[i].cpu, "cpufreq/cpuinfo_max_freq");
+        if (freq > max_freq) max_freq = freq;
+    }
+
+    for (int i = 0; i < n_cpus; i++) {
+        cpus[i].pcore = (max_freq == -1 || ReadCpuValue(cpus[i].cpu, "cpufreq/cpuinfo_max_freq") == max_freq);
+    }
+}
+
+/* online CPUs in id order, returns their number */
+int ReadCpuTopology(struct CpuInfo *cpus, int max_cpus) {
+    assert(cpus);
+
+    cpu_set_t online;
+    if (ReadCpuList("/sys/devices/system/cpu/online", &online) == -1) {
+        CPU_ZERO(&online);
+        if (sched_getaffinity(0, sizeof(online), &online) == -1) {
+            fprintf(stderr, "failed to get online cpus\n");
+            return -1;
+        }
+    }
+
+    int n_cpus = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n_cpus < max_cpus; cpu++) {
+        if (!CPU_ISSET((size_t)cpu, &online)) continue;
+
+        struct CpuInfo *info = &cpus[n_cpus++];
+
+        info->cpu       = cpu;
+        info->package   = (int)ReadCpuValue(cpu, "topology/physical_package_id");
+        info->core      = (int)ReadCpuValue(cpu, "topology/core_id");
+        info->cluster   = (int)ReadCpuValue(cpu, "topology/cluster_id");
+        if (info->core    == -1) info->core    = cpu;
+        if (info->cluster == -1) info->cluster = info->core;
+
+        /* siblings are numbered in CPU id order */
+        info->smt_index = 0;
+        for (int i = 0; i < n_cpus - 1; i++) {
+            if (cpus[i].package == info->package && cpus[i].core == info->core) info->smt_index++;
+        }
+    }
+
+    MarkPerformanceCores(cpus, n_cpus);
+
+    return n_cpus;
+}
+
+struct PlacementKey {
+    long    key[5];
+    int     cpu;
+};
+
+static int CompareKeys(const void *lhs, const void *rhs) {
+    const struct PlacementKey *a = (const struct PlacementKey*)lhs;
+    const struct PlacementKey *b = (const struct PlacementKey*)rhs;
+
+    for (size_t i = 0; i < sizeof(a->key) / sizeof(a->key[0]); i++) {
+        if (a->key[i] != b->key[i]) return (a->key[i] < b->key[i]) ? -1 : 1;
+    }
+
+    return (a->cpu > b->cpu) - (a->cpu < b->cpu);
+}
+
+/* fills cpus with the CPU of every worker slot, returns their number, 0 - do not pin */
+int PlacementOrder(enum PlacementPolicy policy, int *cpus, int max_cpus) {
+    assert(cpus);
+
+    if (policy == PLACEMENT_NONE) return 0;
+
+    struct CpuInfo      *info = calloc((size_t)max_cpus, sizeof(*info));
+    struct PlacementKey *keys = calloc((size_t)max_cpus, sizeof(*keys));
+    if (info == NULL || keys == NULL) {
+        fprintf(stderr, "failed to allocate memory for topology\n");
+        free(info);
+        free(keys);
+        return -1;
+    }
+
+    int n_cpus = ReadCpuTopology(info, max_cpus);
+    if (n_cpus <= 0) {
+        free(info);
+        free(keys);
+        return n_cpus;
+    }
+
+    for (int i = 0; i < n_cpus; i++) {
+        const struct CpuInfo *c = &info[i];
+
+        /* rank of the core inside its cluster, to take one core of every cluster in turn */
+        long rank = 0;
+        for (int j = 0; j < n_cpus; j++) {
+            if (info[j].smt_index == 0 && info[j].package == c->package &&
+                info[j].cluster == c->cluster && info[j].core < c->core) rank++;
+        }
+
+        long *key = keys[i].key;
+        keys[i].cpu = c->cpu;
+
+        switch (policy) {
+            case PLACEMENT_COMPACT:
+                key[0] = c->package; key[1] = c->cluster; key[2] = c->core; key[3] = c->smt_index;
+                break;
+            case PLACEMENT_SCATTER:
+                key[0] = c->smt_index; key[1] = rank; key[2] = c->cluster; key[3] = c->package;
+                break;
+            case PLACEMENT_PHYSICAL_FIRST:
+                key[0] = c->smt_index; key[1] = c->package; key[2] = c->core;
+                break;
+            case PLACEMENT_PCORES_FIRST:
+                key[0] = !c->pcore; key[1] = c->smt_index; key[2] = c->package; key[3] = c->core;
+                break;
+            case PLACEMENT_LINEAR:
+            case PLACEMENT_NONE:
+            case PLACEMENT_COUNT:
+            default:
+                key[0] = c->cpu;
+                break;
+        }
+    }
+
+    qsort(keys, (size_t)n_cpus, sizeof(*keys), CompareKeys);
+
+    for (int i = 0; i < n_cpus; i++) {
+        cpus[i] = keys[i].cpu;
+    }
+
+    free(info);
+    free(keys);
+
+    return n_cpus;
+}
+
+const char* PlacementName(enum PlacementPolicy policy) {
+    if (policy < 0 || policy >= PLACEMENT_COUNT) return "unknown";
+    return POLICY_NAMES[policy];
+}
+
+int ParsePlacement(const char *name, enum PlacementPolicy *policy) {
+    assert(name);
+    assert(policy);
+
+    for (int i = 0; i < PLACEMENT_COUNT; i++) {
+        if (strcmp(name, POLICY_NAMES[i]) == 0) {
+            *policy = (enum PlacementPolicy)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}